@@ -0,0 +1,278 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#include "uthash.h"
+#include "block_cache.h"
+
+typedef struct block_id
+{
+    int inode_value;
+    int block_num;
+} block_id;
+
+typedef struct cached_block
+{
+    block_id id;
+    char *data;
+    size_t size; /* 0 for block missing on server (read as zeros) */
+    struct cached_block *prev; /* lru list, most recently used first */
+    struct cached_block *next;
+    UT_hash_handle hh;
+} cached_block;
+
+/* every shard has its own lock, lru list and part of budget, so threads reading different blocks rarely
+   wait for each other */
+typedef struct cache_shard
+{
+    pthread_mutex_t lock;
+    cached_block *blocks;
+    cached_block *lru_head;
+    cached_block *lru_tail;
+    size_t used;
+    size_t budget;
+} cache_shard;
+
+static cache_shard shards[BLOCK_CACHE_SHARDS];
+static int enabled = 0;
+
+static unsigned long hits = 0;
+static unsigned long misses = 0;
+
+static cache_shard *get_shard(int inode_value, int block_num)
+{
+    unsigned int hash = (unsigned int)inode_value * 2654435761u ^ (unsigned int)block_num * 40503u;
+
+    return &shards[(hash ^ (hash >> 16)) % BLOCK_CACHE_SHARDS];
+}
+
+static size_t entry_size(cached_block *block)
+{
+    return sizeof(cached_block) + block->size;
+}
+
+static void lru_unlink(cache_shard *shard, cached_block *block)
+{
+    if (block->prev != NULL)
+        block->prev->next = block->next;
+    else
+        shard->lru_head = block->next;
+
+    if (block->next != NULL)
+        block->next->prev = block->prev;
+    else
+        shard->lru_tail = block->prev;
+}
+
+static void lru_push_front(cache_shard *shard, cached_block *block)
+{
+    block->prev = NULL;
+    block->next = shard->lru_head;
+
+    if (shard->lru_head != NULL)
+        shard->lru_head->prev = block;
+    else
+        shard->lru_tail = block;
+
+    shard->lru_head = block;
+}
+
+static void remove_block(cache_shard *shard, cached_block *block)
+{
+    lru_unlink(shard, block);
+    HASH_DEL(shard->blocks, block);
+
+    shard->used -= entry_size(block);
+
+    free(block->data);
+    free(block);
+}
+
+static cached_block *find_block(cache_shard *shard, int inode_value, int block_num)
+{
+    block_id id;
+    memset(&id, 0, sizeof(block_id));
+    id.inode_value = inode_value;
+    id.block_num = block_num;
+
+    cached_block *block = NULL;
+    HASH_FIND(hh, shard->blocks, &id, sizeof(block_id), block);
+
+    return block;
+}
+
+/* budget is number of bytes all cached blocks can take, 0 disables cache */
+
+void block_cache_init(size_t budget)
+{
+    enabled = (budget > 0);
+
+    for (int i = 0; i < BLOCK_CACHE_SHARDS; i++)
+    {
+        pthread_mutex_init(&shards[i].lock, NULL);
+        shards[i].blocks = NULL;
+        shards[i].lru_head = NULL;
+        shards[i].lru_tail = NULL;
+        shards[i].used = 0;
+        shards[i].budget = budget / BLOCK_CACHE_SHARDS;
+    }
+}
+
+/* copies part [offset, offset + size) of cached block into dest. returns number of bytes copied
+   (less than size if block is shorter), -1 if block is not cached */
+
+ssize_t block_cache_get(int inode_value, int block_num, char *dest, size_t offset, size_t size)
+{
+    if (!enabled)
+    {
+        return -1;
+    }
+
+    cache_shard *shard = get_shard(inode_value, block_num);
+
+    pthread_mutex_lock(&shard->lock);
+
+    cached_block *block = find_block(shard, inode_value, block_num);
+
+    if (block == NULL)
+    {
+        pthread_mutex_unlock(&shard->lock);
+        __atomic_add_fetch(&misses, 1, __ATOMIC_RELAXED);
+
+        return -1;
+    }
+
+    lru_unlink(shard, block);
+    lru_push_front(shard, block);
+
+    size_t end = (offset + size < block->size) ? offset + size : block->size;
+    ssize_t copied = (end > offset) ? end - offset : 0;
+
+    if (copied > 0)
+    {
+        memcpy(dest, block->data + offset, copied);
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+    __atomic_add_fetch(&hits, 1, __ATOMIC_RELAXED);
+
+    return copied;
+}
+
+static void insert_block(int inode_value, int block_num, char *data, size_t size, int replace)
+{
+    if (!enabled)
+    {
+        return;
+    }
+
+    cache_shard *shard = get_shard(inode_value, block_num);
+
+    cached_block *block = (cached_block *)calloc(1, sizeof(cached_block));
+    block->id.inode_value = inode_value;
+    block->id.block_num = block_num;
+    block->size = size;
+    block->data = (char *)malloc(size + 1);
+    memcpy(block->data, data, size);
+
+    if (entry_size(block) > shard->budget)
+    {
+        free(block->data);
+        free(block);
+
+        if (replace)
+        {
+            block_cache_invalidate(inode_value, block_num);
+        }
+
+        return;
+    }
+
+    pthread_mutex_lock(&shard->lock);
+
+    cached_block *old = find_block(shard, inode_value, block_num);
+
+    if (old != NULL && !replace)
+    {
+        pthread_mutex_unlock(&shard->lock);
+
+        free(block->data);
+        free(block);
+
+        return;
+    }
+
+    if (old != NULL)
+    {
+        remove_block(shard, old);
+    }
+
+    while (shard->used + entry_size(block) > shard->budget)
+    {
+        remove_block(shard, shard->lru_tail);
+    }
+
+    HASH_ADD(hh, shard->blocks, id, sizeof(block_id), block);
+    lru_push_front(shard, block);
+    shard->used += entry_size(block);
+
+    pthread_mutex_unlock(&shard->lock);
+}
+
+/* caches copy of block (replacing older one), least recently used blocks of shard are evicted to fit budget */
+
+void block_cache_put(int inode_value, int block_num, char *data, size_t size)
+{
+    insert_block(inode_value, block_num, data, size, 1);
+}
+
+/* caches copy of block only if it is not cached yet. used for blocks fetched by reads and prefetch, which may
+   be older than block written to cache while they were fetched */
+
+void block_cache_add(int inode_value, int block_num, char *data, size_t size)
+{
+    insert_block(inode_value, block_num, data, size, 0);
+}
+
+void block_cache_invalidate(int inode_value, int block_num)
+{
+    if (!enabled)
+    {
+        return;
+    }
+
+    cache_shard *shard = get_shard(inode_value, block_num);
+
+    pthread_mutex_lock(&shard->lock);
+
+    cached_block *block = find_block(shard, inode_value, block_num);
+
+    if (block != NULL)
+    {
+        remove_block(shard, block);
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+}
+
+void block_cache_stats(unsigned long *cache_hits, unsigned long *cache_misses)
+{
+    *cache_hits = __atomic_load_n(&hits, __ATOMIC_RELAXED);
+    *cache_misses = __atomic_load_n(&misses, __ATOMIC_RELAXED);
+}
+
+void block_cache_free()
+{
+    for (int i = 0; i < BLOCK_CACHE_SHARDS; i++)
+    {
+        pthread_mutex_lock(&shards[i].lock);
+
+        while (shards[i].lru_head != NULL)
+        {
+            remove_block(&shards[i], shards[i].lru_head);
+        }
+
+        pthread_mutex_unlock(&shards[i].lock);
+    }
+}
@@ -0,0 +1,9 @@
+#define BLOCK_CACHE_SHARDS 16
+
+void block_cache_init(size_t budget);
+ssize_t block_cache_get(int inode_value, int block_num, char *dest, size_t offset, size_t size);
+void block_cache_put(int inode_value, int block_num, char *data, size_t size);
+void block_cache_add(int inode_value, int block_num, char *data, size_t size);
+void block_cache_invalidate(int inode_value, int block_num);
+void block_cache_stats(unsigned long *hits, unsigned long *misses);
+void block_cache_free();
@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <dirent.h>
 
 #include "data_parser.h"
 
@@ -25,37 +27,76 @@ char *int_to_string(int x)
     return buf;
 }
 
-char *get_attr_pair_str(char *attr_name, char *value_string)
+/* malloc-ed base64 string with null-terminator */
+char *base64_encode(char *data, size_t size)
 {
-    size_t name_size = strlen(attr_name);
-    size_t value_size = strlen(value_string);
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
-    char *pair = (char *)malloc(name_size + value_size + 3);
+    size_t encoded_size = 4 * ((size + 2) / 3);
+    char *encoded = (char *)malloc(encoded_size + 1);
 
     int index = 0;
+    for (size_t i = 0; i < size; i += 3)
+    {
+        unsigned long triple = (unsigned char)data[i] << 16;
 
-    memcpy(pair + index, attr_name, name_size);
-    index += name_size;
-    pair[index] = '\n';
-    index += 1;
+        if (i + 1 < size)
+            triple |= (unsigned char)data[i + 1] << 8;
+        if (i + 2 < size)
+            triple |= (unsigned char)data[i + 2];
 
-    memcpy(pair + index, value_string, value_size);
-    index += value_size;
-    pair[index] = '\n';
+        encoded[index++] = alphabet[(triple >> 18) & 0x3F];
+        encoded[index++] = alphabet[(triple >> 12) & 0x3F];
+        encoded[index++] = (i + 1 < size) ? alphabet[(triple >> 6) & 0x3F] : '=';
+        encoded[index++] = (i + 2 < size) ? alphabet[triple & 0x3F] : '=';
+    }
 
-    pair[index + 1] = '\0';
+    encoded[index] = '\0';
 
-    return pair;
+    return encoded;
 }
 
-/* malloc-ed string. example: st_ino\n3\n\0 */
-char *get_attr_pair(char *attr_name, unsigned long value)
+/* decodes base64 string made by base64_encode, size is set to number of decoded bytes */
+
+char *base64_decode(char *encoded, size_t *size)
 {
-    char *value_string = ulong_to_string(value);
-    char *pair = get_attr_pair_str(attr_name, value_string);
-    free(value_string);
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    size_t encoded_size = strlen(encoded);
+    char *data = (char *)malloc(3 * (encoded_size / 4) + 1);
+
+    size_t index = 0;
+    for (size_t i = 0; i + 3 < encoded_size; i += 4)
+    {
+        unsigned long quad = 0;
+        int padding = 0;
+
+        for (int j = 0; j < 4; j++)
+        {
+            char *c = strchr(alphabet, encoded[i + j]);
+
+            if (encoded[i + j] == '=' || c == NULL)
+            {
+                padding += 1;
+                quad <<= 6;
+            }
+            else
+            {
+                quad = (quad << 6) | (c - alphabet);
+            }
+        }
+
+        data[index++] = (quad >> 16) & 0xFF;
+        if (padding < 2)
+            data[index++] = (quad >> 8) & 0xFF;
+        if (padding < 1)
+            data[index++] = quad & 0xFF;
+    }
+
+    data[index] = '\0';
+    *size = index;
 
-    return pair;
+    return data;
 }
 
 char *block_key_to_string(int inode_value, int block_num)
@@ -89,180 +130,171 @@ char *block_key_to_string(int inode_value, int block_num)
     return key;
 }
 
-unsigned long get_attr_value(char *attribute_data, char *attr_name)
-{
-    char *value = get_attr_value_str(attribute_data, attr_name);
-    unsigned long value_long = strtoul(value, NULL, 10);
-    free(value);
-
-    return value_long;
-}
-
-char *get_attr_value_str(char *attribute_data, char *attr_name)
+/* directory entries are stored as "name\ninode type\n" pairs, type is d_type of entry (DT_DIR, DT_REG, ...).
+   returns malloc-ed entries with new entry appended */
+char *dentries_add(char *dentries, char *name, int inode_value, int type)
 {
-    char *attr = strstr(attribute_data, attr_name);
+    size_t dentries_size = (dentries != NULL) ? strlen(dentries) : 0;
 
-    if (attr == NULL)
-    {
-        return NULL;
-    }
+    int n = snprintf(NULL, 0, "%s\n%d %d\n", name, inode_value, type);
 
-    int index = (attr - attribute_data) / sizeof(char);
-    index += (strlen(attr_name) + 1);
+    char *new_dentries = (char *)malloc(dentries_size + n + 1);
 
-    int size = 0;
-    char c = '\0';
-    while (c != '\n')
+    if (dentries_size > 0)
     {
-        c = attribute_data[index];
-        index += 1;
-        size += 1;
+        memcpy(new_dentries, dentries, dentries_size);
     }
 
-    char *value = (char *)malloc(size);
-    memcpy(value, attribute_data + index - size, size - 1);
-    value[size - 1] = '\0';
+    snprintf(new_dentries + dentries_size, n + 1, "%s\n%d %d\n", name, inode_value, type);
 
-    return value;
+    return new_dentries;
 }
 
-char *modify_attr(char *attribute_data, char *attr_name, unsigned long new_value)
+/* parses entry at cursor into name (NAME_MAX + 1 bytes), inode_value and type. returns cursor of next entry,
+   NULL if there are no more entries */
+char *dentries_next(char *cursor, char *name, int *inode_value, int *type)
 {
-    char *attr_value = ulong_to_string(new_value);
-
-    char *result_data = modify_attr_str(attribute_data, attr_name, attr_value);
-
-    free(attr_value);
-
-    if (result_data == NULL)
+    if (cursor == NULL || *cursor == '\0')
     {
         return NULL;
     }
 
-    return result_data;
-}
+    char *name_end = strchr(cursor, '\n');
 
-char *modify_attr_str(char *attribute_data, char *attr_name, char *attr_value)
-{
-    char *attr = strstr(attribute_data, attr_name);
-
-    if (attr == NULL) // not supposed to
+    if (name_end == NULL)
     {
         return NULL;
     }
 
-    int index = (attr - attribute_data) / sizeof(char);
+    size_t name_size = name_end - cursor;
+    name_size = (name_size > NAME_MAX) ? NAME_MAX : name_size;
+
+    memcpy(name, cursor, name_size);
+    name[name_size] = '\0';
 
-    int rest_index = index + strlen(attr_name) + 1;
+    *type = DT_UNKNOWN;
 
-    char c = '\0';
-    while (c != '\n')
+    if (sscanf(name_end + 1, "%d %d", inode_value, type) < 1)
     {
-        c = attribute_data[rest_index];
-        rest_index += 1;
+        return NULL;
     }
 
-    char *new_pair = get_attr_pair_str(attr_name, attr_value);
-
-    char *data = (char *)malloc(index + strlen(new_pair) + strlen(attribute_data) - rest_index + 1);
-
-    int data_index = 0;
-    memcpy(data, attribute_data, index);
-    data_index += index;
-    memcpy(data + data_index, new_pair, strlen(new_pair));
-    data_index += strlen(new_pair);
-    memcpy(data + data_index, attribute_data + rest_index, strlen(attribute_data) - rest_index);
-    data_index += (strlen(attribute_data) - rest_index);
+    char *entry_end = strchr(name_end + 1, '\n');
 
-    data[data_index] = '\0';
-
-    free(new_pair);
-
-    return data;
+    return (entry_end != NULL) ? entry_end + 1 : name_end + 1 + strlen(name_end + 1);
 }
 
-char *add_attr(char *attribute_data, char *attr_name, char *value)
+/* inode of entry with name, -1 if directory has no such entry */
+int dentries_find(char *dentries, char *name, int *type)
 {
-    char *new_pair = get_attr_pair_str(attr_name, value);
+    char entry_name[NAME_MAX + 1];
+    int inode_value;
+    int entry_type;
 
-    size_t attribute_data_size = strlen(attribute_data);
-    size_t new_pair_size = strlen(new_pair);
+    char *cursor = dentries;
 
-    char *data = (char *)malloc(attribute_data_size + new_pair_size + 1);
-
-    int index = 0;
-    memcpy(data, attribute_data, attribute_data_size);
-    index += attribute_data_size;
-    memcpy(data + index, new_pair, new_pair_size);
-    index += new_pair_size;
-    data[index] = '\0';
+    while ((cursor = dentries_next(cursor, entry_name, &inode_value, &entry_type)) != NULL)
+    {
+        if (strcmp(entry_name, name) == 0)
+        {
+            if (type != NULL)
+            {
+                *type = entry_type;
+            }
 
-    free(new_pair);
+            return inode_value;
+        }
+    }
 
-    return data;
+    return -1;
 }
 
-char *add_inode_to_table(char *inode_table, char *path, int inode_value)
+/* malloc-ed entries without entry with name (whole name is compared), NULL if there is no such entry */
+char *dentries_remove(char *dentries, char *name)
 {
-    char *inode = int_to_string(inode_value);
+    char entry_name[NAME_MAX + 1];
+    int inode_value;
+    int type;
 
-    size_t table_size = strlen(inode_table);
-    size_t path_size = strlen(path);
-    size_t inode_size = strlen(inode);
+    char *entry = dentries;
+    char *next;
 
-    char *new_table = (char *)malloc(table_size + path_size + inode_size + 3);
+    while ((next = dentries_next(entry, entry_name, &inode_value, &type)) != NULL)
+    {
+        if (strcmp(entry_name, name) == 0)
+        {
+            size_t head_size = entry - dentries;
+            size_t tail_size = strlen(next);
 
-    int index = 0;
-    memcpy(new_table, inode_table, table_size);
-    index += table_size;
-    memcpy(new_table + index, path, path_size);
-    index += path_size;
-    memcpy(new_table + index, "\n", 1);
-    index += 1;
-    memcpy(new_table + index, inode, inode_size);
-    index += inode_size;
-    memcpy(new_table + index, "\n", 1);
-    index += 1;
+            char *new_dentries = (char *)malloc(head_size + tail_size + 1);
 
-    new_table[index] = '\0';
+            memcpy(new_dentries, dentries, head_size);
+            memcpy(new_dentries + head_size, next, tail_size);
+            new_dentries[head_size + tail_size] = '\0';
 
-    free(inode);
+            return new_dentries;
+        }
+
+        entry = next;
+    }
 
-    return new_table;
+    return NULL;
 }
 
-char *remove_inode_from_table(char *inode_table, char *path)
+/* 61 bit fnv-1a hash of entry name. it is readdir cookie of entry (so it fits in off_t with room for "." and
+   "..") and its top bits pick bucket of entry */
+uint64_t dentry_hash(const char *name)
 {
-    char *inode = strstr(inode_table, path);
+    uint64_t hash = 0xcbf29ce484222325ULL;
 
-    if (inode == NULL)
+    for (const unsigned char *c = (const unsigned char *)name; *c != '\0'; c++)
     {
-        printf("inode is null \n");
-        return NULL;
+        hash ^= *c;
+        hash *= 0x100000001b3ULL;
     }
 
-    int index = (inode - inode_table) / sizeof(char);
+    return hash >> 3;
+}
 
-    int rest_index = index + strlen(path) + 1;
+static int compare_dentries(const void *a, const void *b)
+{
+    const dentry *x = (const dentry *)a;
+    const dentry *y = (const dentry *)b;
 
-    char c;
-    while (c != '\n')
+    if (x->hash != y->hash)
     {
-        c = inode_table[rest_index];
-        rest_index += 1;
+        return (x->hash < y->hash) ? -1 : 1;
     }
 
-    char *data = (char *)malloc(index + strlen(inode_table) - rest_index + 1);
+    return strcmp(x->name, y->name);
+}
 
-    int data_index = 0;
-    memcpy(data, inode_table, index);
-    data_index += index;
-    memcpy(data + data_index, inode_table + rest_index, strlen(inode_table) - rest_index);
-    data_index += (strlen(inode_table) - rest_index);
+/* parses all entries into malloc-ed array sorted by hash. returns number of entries */
+int dentries_sorted(char *dentries, dentry **entries)
+{
+    int count = 0;
+    int capacity = 16;
 
-    data[data_index] = '\0';
+    *entries = (dentry *)malloc(capacity * sizeof(dentry));
 
-    return data;
+    char *cursor = dentries;
+    dentry entry;
+
+    while ((cursor = dentries_next(cursor, entry.name, &entry.inode_value, &entry.type)) != NULL)
+    {
+        if (count == capacity)
+        {
+            capacity *= 2;
+            *entries = (dentry *)realloc(*entries, capacity * sizeof(dentry));
+        }
+
+        entry.hash = dentry_hash(entry.name);
+        (*entries)[count++] = entry;
+    }
+
+    qsort(*entries, count, sizeof(dentry), compare_dentries);
+
+    return count;
 }
 
 char *get_parent_directory(const char *path)
@@ -299,113 +331,318 @@ char *get_name_from_path(const char *path)
     return name;
 }
 
-struct list *get_extended_attrs_list(char *attribute_data) // assumes st_blocks is last attribute
+char *construct_path(char *parent_dir, char *linkname)
 {
-    char *attr = strstr(attribute_data, "st_blocks") + strlen("st_blocks") + 1;
+    if (strcmp(parent_dir, "/") == 0)
+    {
+        size_t link_size = strlen(linkname);
+        char *link_path = (char *)malloc(link_size + 2);
+        link_path[0] = '/';
 
-    char c = '0';
-    int index = 0;
+        memcpy(link_path + 1, linkname, link_size);
+        link_path[link_size + 1] = '\0';
+
+        return link_path;
+    }
+
+    size_t link_size = strlen(linkname);
+    size_t path_size = strlen(parent_dir);
+    char *link_path = (char *)malloc(path_size + link_size + 2);
+
+    memcpy(link_path, parent_dir, path_size);
+    memcpy(link_path + path_size, "/", 1);
+    memcpy(link_path + path_size + 1, linkname, link_size);
+
+    link_path[path_size + link_size + 1] = '\0';
+
+    return link_path;
+}
 
-    while (c != '\n')
+static size_t next_xattr(inode_t *inode, size_t offset, char **name, char **value, uint32_t *value_size);
+
+/* binary inode record: inode_attrs (fixed layout), content_size bytes of content, xattrs_size bytes of
+   extended attributes. every extended attribute is name with null-terminator, 4 byte value size and value.
+   record that is cut or whose extended attributes run past its end is not decoded */
+
+int inode_decode(char *data, size_t size, inode_t *inode)
+{
+    if (size < sizeof(inode_attrs))
     {
-        c = attr[index];
-        index += 1;
+        return -1;
     }
 
-    attr = attr + index;
+    memcpy(&inode->attrs, data, sizeof(inode_attrs));
+
+    if (inode->attrs.magic != INODE_MAGIC || inode->attrs.version != INODE_VERSION ||
+        sizeof(inode_attrs) + inode->attrs.content_size + inode->attrs.xattrs_size != size)
+    {
+        return -1;
+    }
 
-    char *token = strtok(attr, "\n");
-    int is_key = 1;
+    inode->content = data + sizeof(inode_attrs);
+    inode->xattrs = inode->content + inode->attrs.content_size;
 
-    list *l = (list *)malloc(sizeof(list));
-    l->size = 0;
-    l->keys = NULL;
+    size_t offset = 0;
 
-    while (token != NULL)
+    while (offset < inode->attrs.xattrs_size)
     {
-        if (is_key)
+        char *name, *value;
+        uint32_t value_size;
+        offset = next_xattr(inode, offset, &name, &value, &value_size);
+
+        if (offset == 0)
         {
-            size_t token_size = strlen(token);
-            size_t size = l->size;
-            l->size += (token_size + 1);
-            l->keys = realloc(l->keys, l->size);
+            return -1;
+        }
+    }
 
-            memcpy(l->keys + size, token, token_size);
-            l->keys[size + token_size] = '\0';
-            printf("token %s\n", token);
+    return 0;
+}
+
+/* malloc-ed record of inode, size is set to its size */
+
+char *inode_encode(inode_t *inode, size_t *size)
+{
+    inode->attrs.magic = INODE_MAGIC;
+    inode->attrs.version = INODE_VERSION;
 
-            is_key = 0;
+    *size = sizeof(inode_attrs) + inode->attrs.content_size + inode->attrs.xattrs_size;
+
+    char *data = (char *)malloc(*size + 1);
+
+    memcpy(data, &inode->attrs, sizeof(inode_attrs));
+    memcpy(data + sizeof(inode_attrs), inode->content, inode->attrs.content_size);
+    memcpy(data + sizeof(inode_attrs) + inode->attrs.content_size, inode->xattrs, inode->attrs.xattrs_size);
+
+    data[*size] = '\0';
+
+    return data;
+}
+
+/* walks extended attributes, returns offset of next one after offset (or xattrs_size), 0 if attribute at
+   offset runs past xattrs_size */
+
+static size_t next_xattr(inode_t *inode, size_t offset, char **name, char **value, uint32_t *value_size)
+{
+    size_t remaining = inode->attrs.xattrs_size - offset;
+
+    *name = inode->xattrs + offset;
+    size_t name_size = strnlen(*name, remaining);
+
+    if (name_size == remaining || remaining - name_size - 1 < sizeof(uint32_t))
+    {
+        return 0;
+    }
+
+    offset += name_size + 1;
+
+    memcpy(value_size, inode->xattrs + offset, sizeof(uint32_t));
+    offset += sizeof(uint32_t);
+
+    if (*value_size > inode->attrs.xattrs_size - offset)
+    {
+        return 0;
+    }
+
+    *value = inode->xattrs + offset;
+
+    return offset + *value_size;
+}
+
+/* value of extended attribute (points into inode record), NULL if inode does not have it */
+
+char *inode_get_xattr(inode_t *inode, char *name, uint32_t *size)
+{
+    size_t offset = 0;
+
+    while (offset < inode->attrs.xattrs_size)
+    {
+        char *xattr_name, *value;
+        offset = next_xattr(inode, offset, &xattr_name, &value, size);
+
+        if (offset == 0) // only record that was not decoded can overrun
+        {
+            break;
         }
-        else
+
+        if (strcmp(xattr_name, name) == 0)
         {
-            is_key = 1;
+            return value;
         }
-        token = strtok(NULL, "\n");
     }
 
-    return l;
+    return NULL;
 }
 
-char *remove_extended_attr(char *attribute_data, char *attr_name)
+/* copies names of extended attributes (each with null-terminator) into list if it is not NULL,
+   returns size of all names */
+
+size_t inode_list_xattrs(inode_t *inode, char *list)
 {
-    char *attr = strstr(attribute_data, attr_name);
+    size_t offset = 0;
+    size_t list_size = 0;
 
-    if (attr == NULL)
+    while (offset < inode->attrs.xattrs_size)
     {
-        return NULL;
+        char *name, *value;
+        uint32_t value_size;
+        offset = next_xattr(inode, offset, &name, &value, &value_size);
+
+        if (offset == 0)
+        {
+            break;
+        }
+
+        if (list != NULL)
+        {
+            memcpy(list + list_size, name, strlen(name) + 1);
+        }
+
+        list_size += strlen(name) + 1;
     }
-    else
-    {
-        int index = (attr - attribute_data) / sizeof(char);
 
-        int size = 0;
+    return list_size;
+}
 
-        char *key_end = strstr(attr, "\n");
+/* malloc-ed extended attributes of inode without attribute name, with it set to value if value is not NULL.
+   size is set to size of new extended attributes */
 
-        size_t key_size = (key_end - attr) / sizeof(char);
+char *inode_replace_xattr(inode_t *inode, char *name, char *value, uint32_t value_size, size_t *size)
+{
+    char *xattrs = (char *)malloc(inode->attrs.xattrs_size + strlen(name) + 1 + sizeof(uint32_t) + value_size + 1);
+    *size = 0;
 
-        size += (key_size + 1);
+    size_t offset = 0;
 
-        char *value_end = strstr(key_end + 1, "\n");
+    while (offset < inode->attrs.xattrs_size)
+    {
+        size_t start = offset;
 
-        size_t value_size = (value_end - key_end);
+        char *xattr_name, *xattr_value;
+        uint32_t xattr_size;
+        offset = next_xattr(inode, offset, &xattr_name, &xattr_value, &xattr_size);
 
-        size += value_size;
+        if (offset == 0)
+        {
+            break;
+        }
 
-        char *modified_data = (char *)malloc(strlen(attribute_data) - size + 1);
+        if (strcmp(xattr_name, name) != 0)
+        {
+            memcpy(xattrs + *size, inode->xattrs + start, offset - start);
+            *size += offset - start;
+        }
+    }
 
-        memcpy(modified_data, attribute_data, index);
-        memcpy(modified_data + index, attribute_data + index + size, strlen(attribute_data) - index - size);
+    if (value != NULL)
+    {
+        memcpy(xattrs + *size, name, strlen(name) + 1);
+        *size += strlen(name) + 1;
 
-        modified_data[strlen(attribute_data) - size] = '\0';
+        memcpy(xattrs + *size, &value_size, sizeof(uint32_t));
+        *size += sizeof(uint32_t);
 
-        return modified_data;
+        memcpy(xattrs + *size, value, value_size);
+        *size += value_size;
     }
+
+    return xattrs;
 }
 
-char *construct_path(char *parent_dir, char *linkname)
+/* converts text record of older versions (name\nvalue\n pairs, extended attributes and symlink target
+   st_content after st_blocks) into binary record. size is set to size of new record. returns NULL if text
+   has no st_mode, so it is not an inode record */
+
+char *inode_upgrade(char *text, size_t *size)
 {
-    if (strcmp(parent_dir, "/") == 0)
+    inode_t inode;
+    memset(&inode, 0, sizeof(inode_t));
+
+    char *content = NULL;
+    char *xattrs = NULL;
+    size_t xattrs_size = 0;
+
+    char *position = text;
+    int has_mode = 0;
+
+    while (strchr(position, '\n') != NULL)
     {
-        size_t link_size = strlen(linkname);
-        char *link_path = (char *)malloc(link_size + 2);
-        link_path[0] = '/';
+        char *name_end = strchr(position, '\n');
+        char *value_end = strchr(name_end + 1, '\n');
 
-        memcpy(link_path + 1, linkname, link_size);
-        link_path[link_size + 1] = '\0';
+        if (value_end == NULL)
+        {
+            break;
+        }
 
-        return link_path;
+        char *name = strndup(position, name_end - position);
+        char *value = strndup(name_end + 1, value_end - name_end - 1);
+
+        if (strcmp(name, "st_ino") == 0)
+            inode.attrs.st_ino = strtoul(value, NULL, 10);
+        else if (strcmp(name, "st_mode") == 0)
+        {
+            inode.attrs.st_mode = strtoul(value, NULL, 10);
+            has_mode = 1;
+        }
+        else if (strcmp(name, "st_uid") == 0)
+            inode.attrs.st_uid = strtoul(value, NULL, 10);
+        else if (strcmp(name, "st_gid") == 0)
+            inode.attrs.st_gid = strtoul(value, NULL, 10);
+        else if (strcmp(name, "st_nlink") == 0)
+            inode.attrs.st_nlink = strtoul(value, NULL, 10);
+        else if (strcmp(name, "st_size") == 0)
+            inode.attrs.st_size = strtoul(value, NULL, 10);
+        else if (strcmp(name, "st_blocks") == 0)
+            inode.attrs.st_blocks = strtoul(value, NULL, 10);
+        else if (strcmp(name, "st_blksize") == 0)
+            inode.attrs.st_blksize = strtoul(value, NULL, 10);
+        else if (strcmp(name, "st_content") == 0)
+        {
+            free(content);
+            content = strdup(value);
+            inode.attrs.content_size = strlen(value);
+        }
+        else if (strcmp(name, "st_inline") == 0)
+        {
+            size_t content_size = 0;
+
+            free(content);
+            content = base64_decode(value, &content_size);
+            inode.attrs.content_size = content_size;
+            inode.attrs.flags |= INODE_INLINE;
+        }
+        else // extended attribute
+        {
+            inode.xattrs = xattrs;
+            inode.attrs.xattrs_size = xattrs_size;
+
+            char *new_xattrs = inode_replace_xattr(&inode, name, value, strlen(value), &xattrs_size);
+            free(xattrs);
+            xattrs = new_xattrs;
+        }
+
+        free(name);
+        free(value);
+
+        position = value_end + 1;
     }
 
-    size_t link_size = strlen(linkname);
-    size_t path_size = strlen(parent_dir);
-    char *link_path = (char *)malloc(path_size + link_size + 2);
+    if (!has_mode)
+    {
+        free(content);
+        free(xattrs);
+        return NULL;
+    }
 
-    memcpy(link_path, parent_dir, path_size);
-    memcpy(link_path + path_size, "/", 1);
-    memcpy(link_path + path_size + 1, linkname, link_size);
+    inode.content = content;
+    inode.xattrs = xattrs;
+    inode.attrs.xattrs_size = xattrs_size;
 
-    link_path[path_size + link_size + 1] = '\0';
+    char *data = inode_encode(&inode, size);
 
-    return link_path;
-}
\ No newline at end of file
+    free(content);
+    free(xattrs);
+
+    return data;
+}
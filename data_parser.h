@@ -1,27 +1,69 @@
-typedef struct list
+#include <stdint.h>
+#include <limits.h>
+
+#define INODE_MAGIC 0x314e494d /* "MIN1" */
+#define INODE_VERSION 1
+
+#define INODE_INLINE 1 /* content is data of small file, otherwise it is symlink target */
+
+/* fixed part of binary inode record */
+typedef struct inode_attrs
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;
+    uint64_t st_ino;
+    uint32_t st_mode;
+    uint32_t st_uid;
+    uint32_t st_gid;
+    uint32_t st_nlink;
+    uint64_t st_size;
+    uint64_t st_blocks;
+    uint32_t st_blksize; /* 0 for inodes stored before block size was recorded */
+    uint32_t content_size;
+    uint32_t xattrs_size;
+    uint32_t reserved;
+} inode_attrs;
+
+/* parsed directory entry, hash orders entries of directory (see dentry_hash) */
+typedef struct dentry
 {
-    char *keys;
-    size_t size;
-} list;
+    uint64_t hash;
+    int inode_value;
+    int type;
+    char name[NAME_MAX + 1];
+} dentry;
+
+/* decoded inode, content and xattrs point into record it was decoded from */
+typedef struct inode_t
+{
+    inode_attrs attrs;
+    char *content;
+    char *xattrs;
+} inode_t;
 
 char *ulong_to_string(unsigned long x);
 char *int_to_string(int x);
-char *get_attr_pair(char *attr_name, unsigned long value);
+char *base64_encode(char *data, size_t size);
+char *base64_decode(char *encoded, size_t *size);
 char *block_key_to_string(int inode_value, int block_num);
 
-char *add_attr(char *attribute_data, char *attr_name, char *value);
-char *modify_attr(char *attribute_data, char *attr_name, unsigned long new_value);
-char *modify_attr_str(char *attribute_data, char *attr_name, char *attr_value);
-unsigned long get_attr_value(char *attribute_data, char *attr_name);
-char *get_attr_value_str(char *attribute_data, char *attr_name);
+int inode_decode(char *data, size_t size, inode_t *inode);
+char *inode_encode(inode_t *inode, size_t *size);
+char *inode_upgrade(char *text, size_t *size);
 
-char *add_inode_to_table(char *inode_table, char *path, int inode_value);
-char *remove_inode_from_table(char *inode_table, char *path);
+char *inode_get_xattr(inode_t *inode, char *name, uint32_t *size);
+size_t inode_list_xattrs(inode_t *inode, char *list);
+char *inode_replace_xattr(inode_t *inode, char *name, char *value, uint32_t value_size, size_t *size);
+
+char *dentries_add(char *dentries, char *name, int inode_value, int type);
+char *dentries_next(char *cursor, char *name, int *inode_value, int *type);
+int dentries_find(char *dentries, char *name, int *type);
+char *dentries_remove(char *dentries, char *name);
+uint64_t dentry_hash(const char *name);
+int dentries_sorted(char *dentries, dentry **entries);
 
 char *get_parent_directory(const char *path);
 char *get_name_from_path(const char *path);
 
-struct list *get_extended_attrs_list(char *attribute_data);
-char *remove_extended_attr(char *attribute_data, char *attr_name);
-
-char *construct_path(char *parent_dir, char *linkname);
\ No newline at end of file
+char *construct_path(char *parent_dir, char *linkname);
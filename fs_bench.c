@@ -0,0 +1,520 @@
+/* Benchmarks of client and filesystem operations against memcached given by mount options (default
+   127.0.0.1:11211). Keys of benchmark runs are left on server, so use memcached started for benchmarks:
+
+       memcached -p 11211 -m 2048 &
+       make bench             (or make fs_bench && ./fs_bench [-o connections=16,...] [benchmark ...])
+
+   benchmarks: threads, protocol, transport, readahead, create, listing. all of them run when none is named. file of readahead
+   is BENCH_FILE_MB (make bench CFLAGS=-DBENCH_FILE_MB=64 for smaller server) */
+
+#define main memcached_main
+#include "main.c"
+#undef main
+
+#define BENCH_MAX_THREADS 16
+#define BENCH_THREAD_OPS 20000
+#define BENCH_BATCH 100
+#define BENCH_BATCH_ROUNDS 200
+#define BENCH_VALUE_SIZE 100
+#define BENCH_LATENCY_GETS 20000
+#define BENCH_READ_SIZE (128 * 1024) /* largest read kernel sends by default */
+
+#define BENCH_CREATE_FILES 100000
+#define BENCH_CREATE_STEP 10000
+#define BENCH_LISTING_FILES 5000
+
+#ifndef BENCH_FILE_MB
+#define BENCH_FILE_MB 1024
+#endif
+
+static double now_seconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void *get_loop(void *arg)
+{
+    for (int i = 0; i < BENCH_THREAD_OPS; i++)
+    {
+        free(memcached_get("fs_bench_key"));
+    }
+
+    return NULL;
+}
+
+/* small gets per second as threads calling client go from 1 to 16, like fuse threads serving requests.
+   every thread checks out its own connection while pool (-o connections=N) has a free one */
+
+static void bench_threads()
+{
+    memcached_set("fs_bench_key", "0123456789", 10);
+
+    for (int num_threads = 1; num_threads <= BENCH_MAX_THREADS; num_threads *= 2)
+    {
+        pthread_t threads[BENCH_MAX_THREADS];
+        double start = now_seconds();
+
+        for (int i = 0; i < num_threads; i++)
+        {
+            pthread_create(&threads[i], NULL, get_loop, NULL);
+        }
+
+        for (int i = 0; i < num_threads; i++)
+        {
+            pthread_join(threads[i], NULL);
+        }
+
+        double elapsed = now_seconds() - start;
+
+        printf("threads %2d: %9.0f gets/s\n", num_threads, num_threads * BENCH_THREAD_OPS / elapsed);
+    }
+}
+
+static int mount_protocol()
+{
+    return (options.protocol != NULL && strcmp(options.protocol, "meta") == 0) ? PROTOCOL_META : PROTOCOL_ASCII;
+}
+
+/* client is connected again with protocol, to servers (mount options if specs is NULL) */
+
+static void reconnect_client(char **specs, int num_specs, int protocol)
+{
+    int engine = (options.engine != NULL && strcmp(options.engine, "epoll") == 0) ? ENGINE_EPOLL : ENGINE_URING;
+
+    memcached_disconnect();
+    memcached_connect(specs != NULL ? specs : options.servers, specs != NULL ? num_specs : options.num_servers,
+                      options.connections, protocol, engine);
+
+    if (options.udp)
+    {
+        memcached_enable_udp();
+    }
+}
+
+/* cost per item of pipelined sets and gets with ascii and with meta protocol. items go in batches of 100
+   (one write and one read per server), so encoding and parsing weigh more than round trips */
+
+static void bench_protocol()
+{
+    char *keys[BENCH_BATCH];
+    char *values[BENCH_BATCH];
+    size_t counts[BENCH_BATCH];
+    char *fetched[BENCH_BATCH];
+    size_t fetched_sizes[BENCH_BATCH];
+
+    for (int i = 0; i < BENCH_BATCH; i++)
+    {
+        keys[i] = (char *)malloc(32);
+        snprintf(keys[i], 32, "fs_bench_item_%d", i);
+
+        values[i] = (char *)malloc(BENCH_VALUE_SIZE);
+        memset(values[i], 'a' + i % 26, BENCH_VALUE_SIZE);
+        counts[i] = BENCH_VALUE_SIZE;
+    }
+
+    int protocols[] = {PROTOCOL_ASCII, PROTOCOL_META};
+
+    for (int p = 0; p < 2; p++)
+    {
+        reconnect_client(NULL, 0, protocols[p]);
+
+        double set_time = 0;
+        double get_time = 0;
+
+        for (int round = 0; round < BENCH_BATCH_ROUNDS; round++)
+        {
+            double start = now_seconds();
+            memcached_set_multi(keys, values, counts, BENCH_BATCH);
+            double stored = now_seconds();
+            memcached_get_multi_sized(keys, BENCH_BATCH, fetched, fetched_sizes);
+            double done = now_seconds();
+
+            set_time += stored - start;
+            get_time += done - stored;
+
+            for (int i = 0; i < BENCH_BATCH; i++)
+            {
+                free(fetched[i]);
+            }
+        }
+
+        int items = BENCH_BATCH * BENCH_BATCH_ROUNDS;
+
+        printf("%s: %6.2f us per set, %6.2f us per get\n", (protocols[p] == PROTOCOL_META) ? "meta " : "ascii",
+               set_time * 1e6 / items, get_time * 1e6 / items);
+    }
+
+    reconnect_client(NULL, 0, mount_protocol());
+
+    for (int i = 0; i < BENCH_BATCH; i++)
+    {
+        free(keys[i]);
+        free(values[i]);
+    }
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* latency of small gets, one at a time, from every server of mount options alone. with
+   -o server=127.0.0.1:11211,server=/path/to/memcached.sock loopback tcp and unix socket are compared */
+
+static void bench_transport()
+{
+    char *default_spec = "127.0.0.1:11211";
+    char **specs = (options.num_servers > 0) ? options.servers : &default_spec;
+    int num_specs = (options.num_servers > 0) ? options.num_servers : 1;
+
+    double *latencies = (double *)malloc(BENCH_LATENCY_GETS * sizeof(double));
+
+    for (int s = 0; s < num_specs; s++)
+    {
+        reconnect_client(&specs[s], 1, mount_protocol());
+
+        memcached_set("fs_bench_key", "0123456789", 10);
+
+        double total = 0;
+
+        for (int i = 0; i < BENCH_LATENCY_GETS; i++)
+        {
+            double start = now_seconds();
+            free(memcached_get("fs_bench_key"));
+            latencies[i] = now_seconds() - start;
+
+            total += latencies[i];
+        }
+
+        qsort(latencies, BENCH_LATENCY_GETS, sizeof(double), compare_doubles);
+
+        printf("%s: %6.1f us mean, %6.1f us median, %6.1f us p99\n", specs[s], total * 1e6 / BENCH_LATENCY_GETS,
+               latencies[BENCH_LATENCY_GETS / 2] * 1e6, latencies[BENCH_LATENCY_GETS * 99 / 100] * 1e6);
+    }
+
+    free(latencies);
+
+    reconnect_client(NULL, 0, mount_protocol());
+}
+
+/* reads whole file through handle in BENCH_READ_SIZE pieces, in order or at random offsets. blocks of file
+   are dropped from block cache first, so every read that is not prefetched goes to server. returns MB/s */
+
+static double read_file(char *path, int inode_value, off_t size, int random)
+{
+    usleep(100 * 1000); // prefetches of previous run finish
+
+    for (int i = 0; i < (size + options.block_size - 1) / options.block_size; i++)
+    {
+        block_cache_invalidate(inode_value, i);
+    }
+
+    struct fuse_file_info fi;
+    memset(&fi, 0, sizeof(fi));
+
+    if (memcached_oper.open(path, &fi) != 0)
+    {
+        return 0;
+    }
+
+    char *buf = (char *)malloc(BENCH_READ_SIZE);
+    int num_reads = size / BENCH_READ_SIZE;
+    int *order = (int *)malloc(num_reads * sizeof(int));
+    unsigned int seed = 1;
+
+    for (int i = 0; i < num_reads; i++)
+    {
+        order[i] = i;
+    }
+
+    for (int i = num_reads - 1; random && i > 0; i--) // every piece is read once, in shuffled order
+    {
+        int j = rand_r(&seed) % (i + 1);
+        int piece = order[i];
+
+        order[i] = order[j];
+        order[j] = piece;
+    }
+
+    double start = now_seconds();
+
+    for (int i = 0; i < num_reads; i++)
+    {
+        memcached_oper.read(path, buf, BENCH_READ_SIZE, order[i] * (off_t)BENCH_READ_SIZE, &fi);
+    }
+
+    double elapsed = now_seconds() - start;
+
+    memcached_oper.release(path, &fi);
+    free(order);
+    free(buf);
+
+    return (double)num_reads * BENCH_READ_SIZE / (1024 * 1024) / elapsed;
+}
+
+/* sequential and random reads of BENCH_FILE_MB file with read-ahead of mount options and without it */
+
+static void bench_readahead()
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/fs_bench_%d", (int)getpid());
+
+    struct fuse_file_info fi;
+    memset(&fi, 0, sizeof(fi));
+
+    if (memcached_oper.create(path, S_IFREG | 0644, &fi) != 0)
+    {
+        printf("could not create %s\n", path);
+        return;
+    }
+
+    char *buf = (char *)malloc(BENCH_READ_SIZE);
+    off_t size = (off_t)BENCH_FILE_MB * 1024 * 1024;
+
+    for (off_t offset = 0; offset < size; offset += BENCH_READ_SIZE)
+    {
+        memset(buf, 'a' + (offset / BENCH_READ_SIZE) % 26, BENCH_READ_SIZE);
+        memcached_oper.write(path, buf, BENCH_READ_SIZE, offset, &fi);
+    }
+
+    memcached_oper.release(path, &fi);
+    free(buf);
+
+    int inode_value = lookup_path(path);
+    int readahead_kb = options.readahead_kb;
+
+    for (int enabled = (readahead_kb > 0); enabled >= 0; enabled--)
+    {
+        options.readahead_kb = enabled ? readahead_kb : 0;
+
+        double sequential = read_file(path, inode_value, size, 0);
+        double random = read_file(path, inode_value, size, 1);
+
+        printf("readahead_kb=%d: %7.1f MB/s sequential, %7.1f MB/s random\n", options.readahead_kb, sequential,
+               random);
+    }
+
+    options.readahead_kb = readahead_kb;
+
+    memcached_oper.unlink(path);
+}
+
+/* creates 100000 files in one directory and prints time of every 10000, which stays the same when create
+   does not depend on number of files already there. files are removed afterwards */
+
+static void bench_create()
+{
+    char dir[64];
+    char path[96];
+    snprintf(dir, sizeof(dir), "/fs_bench_dir_%d", (int)getpid());
+
+    if (memcached_oper.mkdir(dir, 0755) != 0)
+    {
+        printf("could not create %s\n", dir);
+        return;
+    }
+
+    double total = 0;
+
+    for (int step = 0; step < BENCH_CREATE_FILES; step += BENCH_CREATE_STEP)
+    {
+        double start = now_seconds();
+
+        for (int i = step; i < step + BENCH_CREATE_STEP; i++)
+        {
+            struct fuse_file_info fi;
+            memset(&fi, 0, sizeof(fi));
+
+            snprintf(path, sizeof(path), "%s/file_%d", dir, i);
+
+            if (memcached_oper.create(path, S_IFREG | 0644, &fi) == 0)
+            {
+                memcached_oper.release(path, &fi);
+            }
+        }
+
+        double elapsed = now_seconds() - start;
+        total += elapsed;
+
+        printf("files %6d-%6d: %6.3f s, %7.3f s total\n", step, step + BENCH_CREATE_STEP - 1, elapsed, total);
+    }
+
+    for (int i = 0; i < BENCH_CREATE_FILES; i++)
+    {
+        snprintf(path, sizeof(path), "%s/file_%d", dir, i);
+        memcached_oper.unlink(path);
+    }
+
+    memcached_oper.rmdir(dir);
+}
+
+/* names returned by readdir, and how many came with attributes */
+typedef struct listing
+{
+    char (*names)[NAME_MAX + 1];
+    int count;
+    int with_attributes;
+} listing;
+
+static int fill_listing(void *buf, const char *name, const struct stat *stbuf, off_t off,
+                        enum fuse_fill_dir_flags flags)
+{
+    listing *entries = (listing *)buf;
+
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0 || entries->count == BENCH_LISTING_FILES)
+    {
+        return 0;
+    }
+
+    snprintf(entries->names[entries->count], NAME_MAX + 1, "%s", name);
+    entries->count += 1;
+    entries->with_attributes += (stbuf != NULL);
+
+    return 0;
+}
+
+/* ls -l of directory with 5000 files: readdir and getattr of every entry, and readdirplus that returns
+   attributes with entries. inode cache is emptied before each, so attributes come from server */
+
+static void bench_listing()
+{
+    char dir[64];
+    char path[96];
+    snprintf(dir, sizeof(dir), "/fs_bench_list_%d", (int)getpid());
+
+    if (memcached_oper.mkdir(dir, 0755) != 0)
+    {
+        printf("could not create %s\n", dir);
+        return;
+    }
+
+    for (int i = 0; i < BENCH_LISTING_FILES; i++)
+    {
+        struct fuse_file_info fi;
+        memset(&fi, 0, sizeof(fi));
+
+        snprintf(path, sizeof(path), "%s/file_%d", dir, i);
+
+        if (memcached_oper.create(path, S_IFREG | 0644, &fi) == 0)
+        {
+            memcached_oper.release(path, &fi);
+        }
+    }
+
+    listing entries;
+    entries.names = (char(*)[NAME_MAX + 1])malloc(BENCH_LISTING_FILES * sizeof(*entries.names));
+
+    for (int plus = 0; plus <= 1; plus++)
+    {
+        entries.count = 0;
+        entries.with_attributes = 0;
+
+        inode_cache_free();
+
+        double start = now_seconds();
+
+        memcached_oper.readdir(dir, &entries, fill_listing, 0, NULL, plus ? FUSE_READDIR_PLUS : 0);
+
+        for (int i = 0; i < entries.count && entries.with_attributes == 0; i++)
+        {
+            struct stat stbuf;
+            snprintf(path, sizeof(path), "%s/%s", dir, entries.names[i]);
+            memcached_oper.getattr(path, &stbuf, NULL);
+        }
+
+        double elapsed = now_seconds() - start;
+
+        printf("%s: %d entries in %.3f s\n", plus ? "readdirplus       " : "readdir + getattrs", entries.count,
+               elapsed);
+    }
+
+    free(entries.names);
+
+    for (int i = 0; i < BENCH_LISTING_FILES; i++)
+    {
+        snprintf(path, sizeof(path), "%s/file_%d", dir, i);
+        memcached_oper.unlink(path);
+    }
+
+    memcached_oper.rmdir(dir);
+}
+
+static struct benchmark
+{
+    char *name;
+    void (*run)();
+} benchmarks[] = {
+    {"threads", bench_threads},
+    {"protocol", bench_protocol},
+    {"transport", bench_transport},
+    {"readahead", bench_readahead},
+    {"create", bench_create},
+    {"listing", bench_listing},
+};
+
+#define NUM_BENCHMARKS (int)(sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+static int selected(struct fuse_args *args, char *name)
+{
+    if (args->argc < 2)
+    {
+        return 1;
+    }
+
+    for (int i = 1; i < args->argc; i++)
+    {
+        if (strcmp(args->argv[i], name) == 0)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+
+    options.connections = DEFAULT_CONNECTIONS;
+    options.block_cache_mb = DEFAULT_BLOCK_CACHE_MB;
+    options.writeback_kb = DEFAULT_WRITEBACK_KB;
+    options.readahead_kb = DEFAULT_READAHEAD_KB;
+    options.block_size = FILE_BLOCK_SIZE;
+    options.inline_size = DEFAULT_INLINE_SIZE;
+    options.attr_timeout = DEFAULT_ATTR_TIMEOUT;
+    options.entry_timeout = DEFAULT_ENTRY_TIMEOUT;
+    options.negative_timeout = DEFAULT_NEGATIVE_TIMEOUT;
+    options.path_cache = DEFAULT_PATH_CACHE;
+
+    if (fuse_opt_parse(&args, &options, option_spec, option_proc) == -1)
+    {
+        return 1;
+    }
+
+    struct fuse_conn_info conn;
+    struct fuse_config cfg;
+    memset(&conn, 0, sizeof(conn));
+    memset(&cfg, 0, sizeof(cfg));
+
+    memcached_oper.init(&conn, &cfg);
+
+    for (int i = 0; i < NUM_BENCHMARKS; i++)
+    {
+        if (selected(&args, benchmarks[i].name))
+        {
+            printf("%s\n", benchmarks[i].name);
+            benchmarks[i].run();
+        }
+    }
+
+    fuse_opt_free_args(&args);
+
+    return 0;
+}
@@ -0,0 +1,405 @@
+/* Checks of record formats and directory operations. Records are checked without server, directory operations
+   run through fuse operations against memcached given by mount options (default 127.0.0.1:11211). memcached
+   without filesystem is flushed on start, so use one started for tests:
+
+       memcached -p 11211 &
+       make test              (or make fs_test && ./fs_test [-o protocol=meta,lazy,...])
+
+   every run works in its own directory /fs_test_<pid>. exits with 1 at first failed check */
+
+#define main memcached_main
+#include "main.c"
+#undef main
+
+#define CHECK(condition)                                                                  \
+    do                                                                                    \
+    {                                                                                     \
+        if (!(condition))                                                                 \
+        {                                                                                 \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            exit(1);                                                                      \
+        }                                                                                 \
+    } while (0)
+
+#define BIG_DIRECTORY_FILES 1000
+#define READDIR_PAGE 100
+
+static char top[64];
+
+static char *test_path(const char *name)
+{
+    static char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s%s", top, name);
+
+    return path;
+}
+
+static uint64_t path_ino(const char *name)
+{
+    struct stat stbuf;
+
+    if (memcached_oper.getattr(test_path(name), &stbuf, NULL) != 0)
+    {
+        return 0;
+    }
+
+    return stbuf.st_ino;
+}
+
+static void create_file(const char *name)
+{
+    struct fuse_file_info fi;
+    memset(&fi, 0, sizeof(fi));
+
+    CHECK(memcached_oper.create(test_path(name), S_IFREG | 0644, &fi) == 0);
+    CHECK(memcached_oper.release(test_path(name), &fi) == 0);
+}
+
+/* binary record keeps all attributes, content and extended attributes, text record of older version is
+   upgraded to same binary record. records with extended attributes past their end and text without st_mode
+   are rejected */
+
+static void test_inode_records()
+{
+    inode_t inode;
+    memset(&inode, 0, sizeof(inode_t));
+
+    inode.attrs.st_ino = 42;
+    inode.attrs.st_mode = S_IFLNK | 0777;
+    inode.attrs.st_nlink = 1;
+    inode.attrs.st_uid = 1000;
+    inode.attrs.st_gid = 100;
+    inode.attrs.st_size = 6;
+    inode.attrs.st_blksize = 4096;
+    inode.content = "/a/b/c";
+    inode.attrs.content_size = 6;
+
+    size_t xattrs_size = 0;
+    inode.xattrs = inode_replace_xattr(&inode, "user.color", "blue", 4, &xattrs_size);
+    inode.attrs.xattrs_size = xattrs_size;
+
+    size_t size = 0;
+    char *record = inode_encode(&inode, &size);
+    free(inode.xattrs);
+
+    inode_t decoded;
+    CHECK(inode_decode(record, size, &decoded) == 0);
+    CHECK(decoded.attrs.st_ino == 42 && decoded.attrs.st_mode == (S_IFLNK | 0777));
+    CHECK(decoded.attrs.st_uid == 1000 && decoded.attrs.st_gid == 100 && decoded.attrs.st_nlink == 1);
+    CHECK(decoded.attrs.st_size == 6 && decoded.attrs.st_blksize == 4096);
+    CHECK(decoded.attrs.content_size == 6 && memcmp(decoded.content, "/a/b/c", 6) == 0);
+
+    uint32_t value_size = 0;
+    char *value = inode_get_xattr(&decoded, "user.color", &value_size);
+    CHECK(value != NULL && value_size == 4 && memcmp(value, "blue", 4) == 0);
+    CHECK(inode_get_xattr(&decoded, "user.size", &value_size) == NULL);
+
+    CHECK(inode_decode(record, sizeof(inode_attrs) - 1, &decoded) != 0); // cut record
+
+    // value size of last extended attribute runs past end of record
+    uint32_t overrun = 5;
+    memcpy(record + size - 4 - sizeof(uint32_t), &overrun, sizeof(uint32_t));
+    CHECK(inode_decode(record, size, &decoded) != 0);
+
+    // name of extended attribute is not terminated within record
+    inode_attrs *attrs = (inode_attrs *)record;
+    attrs->xattrs_size = strlen("user.color");
+    CHECK(inode_decode(record, sizeof(inode_attrs) + attrs->content_size + attrs->xattrs_size, &decoded) != 0);
+    free(record);
+
+    CHECK(inode_upgrade("name\nvalue\n", &size) == NULL); // not an inode record
+
+    char *text = strdup("st_ino\n7\nst_mode\n33188\nst_uid\n0\nst_gid\n0\nst_nlink\n1\nst_size\n3\nst_blocks\n0\n"
+                        "st_inline\nYWJj\nuser.note\nhi\n");
+    CHECK(inode_decode(text, strlen(text), &decoded) != 0);
+
+    size = 0;
+    record = inode_upgrade(text, &size);
+    free(text);
+
+    CHECK(inode_decode(record, size, &decoded) == 0);
+    CHECK(decoded.attrs.st_ino == 7 && decoded.attrs.st_mode == (S_IFREG | 0644) && decoded.attrs.st_size == 3);
+    CHECK(decoded.attrs.st_blksize == 0 && inode_block_size(&decoded) == FILE_BLOCK_SIZE);
+    CHECK((decoded.attrs.flags & INODE_INLINE) && decoded.attrs.content_size == 3);
+    CHECK(memcmp(decoded.content, "abc", 3) == 0);
+
+    value = inode_get_xattr(&decoded, "user.note", &value_size);
+    CHECK(value != NULL && value_size == 2 && memcmp(value, "hi", 2) == 0);
+
+    free(record);
+}
+
+/* entries are sorted by hash, and buckets of split directory follow same order */
+
+static void test_dentry_order()
+{
+    char *dentries = NULL;
+
+    for (int i = 0; i < 500; i++)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "entry_%d", i);
+
+        char *new_dentries = dentries_add(dentries, name, i + 1, DT_REG);
+        free(dentries);
+        dentries = new_dentries;
+    }
+
+    dentry *entries = NULL;
+    int count = dentries_sorted(dentries, &entries);
+
+    CHECK(count == 500);
+
+    for (int i = 1; i < count; i++)
+    {
+        CHECK(entries[i - 1].hash <= entries[i].hash);
+        CHECK(dentry_bucket(entries[i - 1].hash, DENTRY_BUCKETS) <= dentry_bucket(entries[i].hash, DENTRY_BUCKETS));
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        CHECK(entries[i].hash == dentry_hash(entries[i].name) && entries[i].hash < (1ULL << 61));
+        CHECK(dentries_find(dentries, entries[i].name, NULL) == entries[i].inode_value);
+    }
+
+    CHECK(dentry_bucket(0, DENTRY_BUCKETS) == 0);
+    CHECK(dentry_bucket((1ULL << 61) - 1, DENTRY_BUCKETS) == DENTRY_BUCKETS - 1);
+
+    free(entries);
+    free(dentries);
+}
+
+typedef struct readdir_page
+{
+    int added;
+    off_t last_off;
+    int seen[BIG_DIRECTORY_FILES];
+    int dots;
+} readdir_page;
+
+static int page_filler(void *buf, const char *name, const struct stat *stbuf, off_t off,
+                       enum fuse_fill_dir_flags flags)
+{
+    readdir_page *page = (readdir_page *)buf;
+
+    if (page->added == READDIR_PAGE)
+    {
+        return 1;
+    }
+
+    CHECK(off > page->last_off);
+
+    int number = -1;
+
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+    {
+        page->dots += 1;
+    }
+    else
+    {
+        CHECK(sscanf(name, "file_number_%d", &number) == 1 && number >= 0 && number < BIG_DIRECTORY_FILES);
+        page->seen[number] += 1;
+    }
+
+    page->added += 1;
+    page->last_off = off;
+
+    return 0;
+}
+
+/* directory outgrowing its record is split into buckets, readdir continues from offset of last entry it
+   returned, also when entries it did not return yet are removed meanwhile */
+
+static void test_big_directory()
+{
+    CHECK(memcached_oper.mkdir(test_path("/big"), 0755) == 0);
+
+    for (int i = 0; i < BIG_DIRECTORY_FILES; i++)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "/big/file_number_%d", i);
+        create_file(name);
+    }
+
+    int dir_value = (int)path_ino("/big");
+    char *block_key = block_key_to_string(dir_value, 0);
+    unsigned long long cas = 0;
+    char *record = memcached_gets(block_key, &cas);
+    int split = -1;
+
+    CHECK(dentry_buckets(record, &split) == DENTRY_BUCKETS && split != -1);
+
+    // split that lost race for record does not touch buckets in use
+    char *stale = dentries_add(NULL, "file_number_0", 1, DT_REG);
+    CHECK(split_dentries(dir_value, stale, cas + 1) != 1);
+    CHECK(find_dentry(dir_value, "file_number_0", NULL) != 1 && find_dentry(dir_value, "file_number_1", NULL) != -1);
+
+    char *current = get_dentries(dir_value);
+    CHECK(strcmp(current, record) == 0);
+
+    free(current);
+    free(stale);
+    free(record);
+    free(block_key);
+
+    readdir_page *page = (readdir_page *)calloc(1, sizeof(readdir_page));
+    int removed = -1;
+    int pages = 0;
+
+    do
+    {
+        page->added = 0;
+
+        CHECK(memcached_oper.readdir(test_path("/big"), page, page_filler, page->last_off, NULL, 0) == 0);
+        pages += 1;
+
+        if (pages == 1) // drop entry that will come on later page
+        {
+            for (removed = 0; page->seen[removed] != 0; removed++)
+            {
+            }
+
+            char name[64];
+            snprintf(name, sizeof(name), "/big/file_number_%d", removed);
+            CHECK(memcached_oper.unlink(test_path(name)) == 0);
+        }
+    } while (page->added == READDIR_PAGE);
+
+    CHECK(pages > 1 && page->dots == 2);
+
+    for (int i = 0; i < BIG_DIRECTORY_FILES; i++)
+    {
+        CHECK(page->seen[i] == ((i == removed) ? 0 : 1));
+    }
+
+    free(page);
+
+    CHECK(memcached_oper.rmdir(test_path("/big")) == -ENOTEMPTY);
+
+    for (int i = 0; i < BIG_DIRECTORY_FILES; i++)
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "/big/file_number_%d", i);
+
+        if (i != removed)
+        {
+            CHECK(memcached_oper.unlink(test_path(name)) == 0);
+        }
+    }
+
+    CHECK(memcached_oper.rmdir(test_path("/big")) == 0);
+    CHECK(path_ino("/big") == 0);
+}
+
+static void test_rename()
+{
+    CHECK(memcached_oper.mkdir(test_path("/r"), 0755) == 0);
+    create_file("/r/a");
+    create_file("/r/b");
+
+    uint64_t a = path_ino("/r/a");
+    uint64_t b = path_ino("/r/b");
+
+    CHECK(memcached_oper.rename(test_path("/r/a"), test_path("/r/b"), RENAME_NOREPLACE) == -EEXIST);
+    CHECK(path_ino("/r/a") == a && path_ino("/r/b") == b);
+
+    char new_path[PATH_MAX];
+    snprintf(new_path, sizeof(new_path), "%s", test_path("/r/c"));
+
+    CHECK(memcached_oper.rename(test_path("/r/a"), new_path, RENAME_NOREPLACE) == 0);
+    CHECK(path_ino("/r/a") == 0 && path_ino("/r/c") == a);
+
+    snprintf(new_path, sizeof(new_path), "%s", test_path("/r/b"));
+
+    CHECK(memcached_oper.rename(test_path("/r/c"), new_path, RENAME_EXCHANGE) == 0);
+    CHECK(path_ino("/r/c") == b && path_ino("/r/b") == a);
+
+    snprintf(new_path, sizeof(new_path), "%s", test_path("/r/missing"));
+
+    CHECK(memcached_oper.rename(test_path("/r/c"), new_path, RENAME_EXCHANGE) == -ENOENT);
+    CHECK(memcached_oper.rename(test_path("/r/c"), new_path, RENAME_EXCHANGE | RENAME_NOREPLACE) == -EINVAL);
+
+    // plain rename replaces target, paths under renamed directory follow it
+    snprintf(new_path, sizeof(new_path), "%s", test_path("/r/b"));
+
+    CHECK(memcached_oper.rename(test_path("/r/c"), new_path, 0) == 0);
+    CHECK(path_ino("/r/c") == 0 && path_ino("/r/b") == b);
+
+    CHECK(memcached_oper.mkdir(test_path("/r/d"), 0755) == 0);
+    create_file("/r/d/x");
+
+    uint64_t x = path_ino("/r/d/x");
+    snprintf(new_path, sizeof(new_path), "%s", test_path("/r/e"));
+
+    CHECK(memcached_oper.rename(test_path("/r/d"), new_path, 0) == 0);
+    CHECK(path_ino("/r/d/x") == 0 && path_ino("/r/e/x") == x);
+
+    // directory can not move into itself or below itself
+    CHECK(memcached_oper.mkdir(test_path("/r/e/sub"), 0755) == 0);
+    snprintf(new_path, sizeof(new_path), "%s", test_path("/r/e/sub/e"));
+
+    CHECK(memcached_oper.rename(test_path("/r/e"), new_path, 0) == -EINVAL);
+
+    snprintf(new_path, sizeof(new_path), "%s", test_path("/r"));
+    CHECK(memcached_oper.rename(test_path("/r/e/sub"), new_path, RENAME_EXCHANGE) == -EINVAL);
+    CHECK(path_ino("/r/e/sub") != 0 && path_ino("/r/e/sub/e") == 0);
+
+    // low-level interface finds directories above destination from parents of entries kernel got
+    int r = lookup_path(test_path("/r"));
+    int e = lookup_path(test_path("/r/e"));
+    int sub = lookup_path(test_path("/r/e/sub"));
+
+    node_lookup(e, r);
+    node_lookup(sub, e);
+
+    CHECK(rename_dentry(r, "e", e, "e", 0) == -EINVAL);
+    CHECK(rename_dentry(r, "e", sub, "e", 0) == -EINVAL);
+    CHECK(rename_dentry(e, "sub", r, "sub", 0) == 0 && find_dentry(r, "sub", NULL) == sub);
+    CHECK(rename_dentry(r, "e", sub, "e", 0) == 0 && find_dentry(sub, "e", NULL) == e);
+
+    node_forget(e, 1);
+    node_forget(sub, 1);
+}
+
+int main(int argc, char *argv[])
+{
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+
+    options.connections = DEFAULT_CONNECTIONS;
+    options.block_cache_mb = DEFAULT_BLOCK_CACHE_MB;
+    options.writeback_kb = DEFAULT_WRITEBACK_KB;
+    options.readahead_kb = DEFAULT_READAHEAD_KB;
+    options.block_size = FILE_BLOCK_SIZE;
+    options.inline_size = DEFAULT_INLINE_SIZE;
+    options.attr_timeout = DEFAULT_ATTR_TIMEOUT;
+    options.entry_timeout = DEFAULT_ENTRY_TIMEOUT;
+    options.negative_timeout = DEFAULT_NEGATIVE_TIMEOUT;
+    options.path_cache = DEFAULT_PATH_CACHE;
+
+    if (fuse_opt_parse(&args, &options, option_spec, option_proc) == -1)
+    {
+        return 1;
+    }
+
+    test_inode_records();
+    test_dentry_order();
+
+    struct fuse_conn_info conn;
+    struct fuse_config cfg;
+    memset(&conn, 0, sizeof(conn));
+    memset(&cfg, 0, sizeof(cfg));
+
+    memcached_oper.init(&conn, &cfg);
+
+    snprintf(top, sizeof(top), "/fs_test_%d", (int)getpid());
+    CHECK(memcached_oper.mkdir(top, 0755) == 0);
+
+    test_big_directory();
+    test_rename();
+
+    printf("all checks passed\n");
+
+    fuse_opt_free_args(&args);
+
+    return 0;
+}
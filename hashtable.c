@@ -1,14 +1,32 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <pthread.h>
 
 #include "hashtable.h"
 
+hashable *inode_table = NULL;
+
+hashable_attr *attributes = NULL;
+
+/* fuse runs handlers on multiple threads, every access to inode_table goes through this lock */
+static pthread_rwlock_t inode_table_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/* 0 - inode_table holds every path. otherwise it is cache of paths resolved on demand, oldest paths are dropped
+   when it has more entries (uthash keeps insertion order, first entry is oldest) */
+static unsigned int max_entries = 0;
+
 void hashtable_init()
 {
     inode_table = NULL;
     attributes = NULL;
 }
 
+void hashtable_set_limit(unsigned int limit)
+{
+    max_entries = limit;
+}
+
 void hashtable_add_entry(char *link, int inode_value)
 {
     hashable *new_item = (hashable *)malloc(sizeof(hashable));
@@ -16,12 +34,36 @@ void hashtable_add_entry(char *link, int inode_value)
     strcpy(new_item->key, link);
     new_item->inode_value = inode_value;
 
-    HASH_ADD_STR(inode_table, key, new_item);
+    pthread_rwlock_wrlock(&inode_table_lock);
+
+    hashable *old = NULL;
+    HASH_FIND_STR(inode_table, link, old);
+
+    if (old != NULL) // resolved by other thread in meantime
+    {
+        old->inode_value = inode_value;
+        free(new_item);
+    }
+    else
+    {
+        HASH_ADD_STR(inode_table, key, new_item);
+    }
+
+    while (max_entries > 0 && HASH_COUNT(inode_table) > max_entries)
+    {
+        hashable *oldest = inode_table;
+        HASH_DEL(inode_table, oldest);
+        free(oldest);
+    }
+
+    pthread_rwlock_unlock(&inode_table_lock);
 }
 
 int hashable_get_entry(char *link)
 {
-    hashable *h = (hashable *)malloc(sizeof(hashable));
+    hashable *h = NULL;
+
+    pthread_rwlock_rdlock(&inode_table_lock);
     HASH_FIND_STR(inode_table, link, h);
 
     int value = -1;
@@ -30,23 +72,84 @@ int hashable_get_entry(char *link)
     {
         value = h->inode_value;
     }
+    pthread_rwlock_unlock(&inode_table_lock);
 
     return value;
 }
 
 int hashtable_remove_entry(char *link)
 {
-    hashable *h = (hashable *)malloc(sizeof(hashable));
+    hashable *h = NULL;
 
+    pthread_rwlock_wrlock(&inode_table_lock);
     HASH_FIND_STR(inode_table, link, h);
-    int value = h->inode_value;
 
-    HASH_DEL(inode_table, h);
-    free(h);
+    int value = -1;
+
+    if (h)
+    {
+        value = h->inode_value;
+        HASH_DEL(inode_table, h);
+        free(h);
+    }
+    pthread_rwlock_unlock(&inode_table_lock);
 
     return value;
 }
 
+/* entries of link and of paths under it (link/...) are moved under new_link, for renamed files and directories */
+void hashtable_move_prefix(char *link, char *new_link)
+{
+    size_t link_size = strlen(link);
+    size_t new_link_size = strlen(new_link);
+
+    hashable *moved = NULL;
+    hashable *current, *tmp;
+
+    pthread_rwlock_wrlock(&inode_table_lock);
+
+    HASH_ITER(hh, inode_table, current, tmp)
+    {
+        if (strncmp(current->key, link, link_size) != 0 || (current->key[link_size] != '\0' && current->key[link_size] != '/'))
+        {
+            continue;
+        }
+
+        size_t rest_size = strlen(current->key + link_size);
+
+        HASH_DEL(inode_table, current);
+
+        if (new_link_size + rest_size >= MAX_KEY_SIZE) // new path does not fit in index
+        {
+            free(current);
+            continue;
+        }
+
+        memmove(current->key + new_link_size, current->key + link_size, rest_size + 1);
+        memcpy(current->key, new_link, new_link_size);
+
+        HASH_ADD_STR(moved, key, current);
+    }
+
+    HASH_ITER(hh, moved, current, tmp)
+    {
+        HASH_DEL(moved, current);
+
+        hashable *old = NULL;
+        HASH_FIND_STR(inode_table, current->key, old);
+
+        if (old != NULL)
+        {
+            HASH_DEL(inode_table, old);
+            free(old);
+        }
+
+        HASH_ADD_STR(inode_table, key, current);
+    }
+
+    pthread_rwlock_unlock(&inode_table_lock);
+}
+
 void hashtable_string_to_table(char *links) // link\nvalue\nlink\nvalue\n\0
 {
     char cur = '\r';
@@ -153,16 +256,22 @@ void hashtable_free_attributes()
 
 int hashtable_count()
 {
-    return HASH_COUNT(inode_table);
+    pthread_rwlock_rdlock(&inode_table_lock);
+    int count = HASH_COUNT(inode_table);
+    pthread_rwlock_unlock(&inode_table_lock);
+
+    return count;
 }
 
 void hashtable_free()
 {
     struct hashable *current, *tmp;
 
+    pthread_rwlock_wrlock(&inode_table_lock);
     HASH_ITER(hh, inode_table, current, tmp)
     {
         HASH_DEL(inode_table, current);
         free(current);
     }
+    pthread_rwlock_unlock(&inode_table_lock);
 }
\ No newline at end of file
@@ -16,16 +16,18 @@ typedef struct hashable_attr
     UT_hash_handle hh;
 } hashable_attr;
 
-hashable *inode_table;
+extern hashable *inode_table;
 
-hashable_attr *attributes;
+extern hashable_attr *attributes;
 
 void hashtable_init();
+void hashtable_set_limit(unsigned int limit);
 void hashtable_add_entry(char *link, int inode_value);
 int hashable_get_entry(char *link);
 void hashtable_string_to_table(char *links);
 int hashtable_count();
 int hashtable_remove_entry(char *link);
+void hashtable_move_prefix(char *link, char *new_link);
 
 void hashtable_construct_attributes(char *attribute_data);
 unsigned long hashtable_get_attribute(char *attr_name);
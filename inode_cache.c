@@ -0,0 +1,191 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#include "uthash.h"
+#include "inode_cache.h"
+
+typedef struct cached_inode
+{
+    int inode_value;
+    char *record;
+    size_t size;
+    struct timespec stored; /* record is valid for timeout seconds after it */
+    UT_hash_handle hh;
+} cached_inode;
+
+/* uthash keeps insertion order, entries are re-added on every hit, so first entry is least recently used */
+static cached_inode *inodes = NULL;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double timeout = 0;
+
+static unsigned long hits = 0;
+static unsigned long misses = 0;
+
+static void remove_inode(cached_inode *inode)
+{
+    HASH_DEL(inodes, inode);
+
+    free(inode->record);
+    free(inode);
+}
+
+static int expired(cached_inode *inode)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    double age = (now.tv_sec - inode->stored.tv_sec) + (now.tv_nsec - inode->stored.tv_nsec) / 1e9;
+
+    return age >= timeout;
+}
+
+/* inode records are cached for timeout seconds, 0 disables cache */
+
+void inode_cache_init(double cache_timeout)
+{
+    timeout = cache_timeout;
+}
+
+/* malloc-ed copy of cached record, NULL if inode is not cached or its record expired */
+
+char *inode_cache_get(int inode_value, size_t *size)
+{
+    if (timeout <= 0)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&lock);
+
+    cached_inode *inode = NULL;
+    HASH_FIND_INT(inodes, &inode_value, inode);
+
+    if (inode != NULL && expired(inode))
+    {
+        remove_inode(inode);
+        inode = NULL;
+    }
+
+    if (inode == NULL)
+    {
+        pthread_mutex_unlock(&lock);
+        __atomic_add_fetch(&misses, 1, __ATOMIC_RELAXED);
+
+        return NULL;
+    }
+
+    HASH_DEL(inodes, inode);
+    HASH_ADD_INT(inodes, inode_value, inode);
+
+    char *record = (char *)malloc(inode->size + 1);
+    memcpy(record, inode->record, inode->size);
+    record[inode->size] = '\0';
+    *size = inode->size;
+
+    pthread_mutex_unlock(&lock);
+    __atomic_add_fetch(&hits, 1, __ATOMIC_RELAXED);
+
+    return record;
+}
+
+static void insert_inode(int inode_value, char *record, size_t size, int replace)
+{
+    if (timeout <= 0)
+    {
+        return;
+    }
+
+    cached_inode *inode = (cached_inode *)malloc(sizeof(cached_inode));
+    inode->inode_value = inode_value;
+    inode->record = (char *)malloc(size);
+    memcpy(inode->record, record, size);
+    inode->size = size;
+    clock_gettime(CLOCK_MONOTONIC, &inode->stored);
+
+    pthread_mutex_lock(&lock);
+
+    cached_inode *old = NULL;
+    HASH_FIND_INT(inodes, &inode_value, old);
+
+    if (old != NULL && !replace && !expired(old))
+    {
+        pthread_mutex_unlock(&lock);
+
+        free(inode->record);
+        free(inode);
+
+        return;
+    }
+
+    if (old != NULL)
+    {
+        remove_inode(old);
+    }
+    else if (HASH_COUNT(inodes) >= INODE_CACHE_MAX_ENTRIES)
+    {
+        remove_inode(inodes);
+    }
+
+    HASH_ADD_INT(inodes, inode_value, inode);
+
+    pthread_mutex_unlock(&lock);
+}
+
+/* caches copy of record (replacing older one), least recently used inode is dropped when cache is full */
+
+void inode_cache_put(int inode_value, char *record, size_t size)
+{
+    insert_inode(inode_value, record, size, 1);
+}
+
+/* caches copy of record only if inode is not cached yet. used for records read from server, which may be
+   older than record written to cache while they were read */
+
+void inode_cache_add(int inode_value, char *record, size_t size)
+{
+    insert_inode(inode_value, record, size, 0);
+}
+
+void inode_cache_invalidate(int inode_value)
+{
+    if (timeout <= 0)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&lock);
+
+    cached_inode *inode = NULL;
+    HASH_FIND_INT(inodes, &inode_value, inode);
+
+    if (inode != NULL)
+    {
+        remove_inode(inode);
+    }
+
+    pthread_mutex_unlock(&lock);
+}
+
+void inode_cache_stats(unsigned long *cache_hits, unsigned long *cache_misses)
+{
+    *cache_hits = __atomic_load_n(&hits, __ATOMIC_RELAXED);
+    *cache_misses = __atomic_load_n(&misses, __ATOMIC_RELAXED);
+}
+
+void inode_cache_free()
+{
+    pthread_mutex_lock(&lock);
+
+    cached_inode *inode, *tmp;
+
+    HASH_ITER(hh, inodes, inode, tmp)
+    {
+        remove_inode(inode);
+    }
+
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,9 @@
+#define INODE_CACHE_MAX_ENTRIES 65536
+
+void inode_cache_init(double timeout);
+char *inode_cache_get(int inode_value, size_t *size);
+void inode_cache_put(int inode_value, char *record, size_t size);
+void inode_cache_add(int inode_value, char *record, size_t size);
+void inode_cache_invalidate(int inode_value);
+void inode_cache_stats(unsigned long *hits, unsigned long *misses);
+void inode_cache_free();
@@ -1,23 +1,57 @@
 #define FUSE_USE_VERSION 31
 #define FILE_BLOCK_SIZE 1024
+#define MAX_FILE_BLOCK_SIZE (1024 * 1024)
+#define DEFAULT_CONNECTIONS 8
+#define INODE_LEASE_SIZE 1024
+#define ROOT_INODE 0
+#define DEFAULT_BLOCK_CACHE_MB 64
+#define DEFAULT_WRITEBACK_KB 256
+#define WRITEBACK_INTERVAL_MS 1000
+#define DEFAULT_READAHEAD_KB 1024
+#define READAHEAD_THREADS 2
+#define DEFAULT_INLINE_SIZE 1024
+#define DEFAULT_ATTR_TIMEOUT 1.0
+#define DEFAULT_ENTRY_TIMEOUT 1.0
+#define DEFAULT_NEGATIVE_TIMEOUT 1.0
+#define DEFAULT_PATH_CACHE 65536
+#define DENTRY_RECORD_MAX 16384 /* bigger directory record is split into buckets */
+#define DENTRY_BUCKETS 1024
+#define DENTRY_BATCH_MAX 64 /* buckets read by one request of readdir */
+#define READDIRPLUS_BATCH 128 /* inodes read by one request of readdirplus */
 
 #include <fuse.h>
+#include <fuse_lowlevel.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <assert.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <time.h>
+#include <limits.h>
+#include <dirent.h>
+
+#ifndef RENAME_NOREPLACE
+#define RENAME_NOREPLACE (1 << 0)
+#endif
+
+#ifndef RENAME_EXCHANGE
+#define RENAME_EXCHANGE (1 << 1)
+#endif
+#include <pthread.h>
 
 #include "memcached_client.h"
 #include "hashtable.h"
 #include "data_parser.h"
 #include "random_access.h"
+#include "block_cache.h"
+#include "inode_cache.h"
+#include "negative_cache.h"
 
 static void *memcached_init(struct fuse_conn_info *conn, struct fuse_config *cfg);
 static int memcached_getattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi);
@@ -51,9 +85,84 @@ static int memcached_chmod(const char *path, mode_t mode, struct fuse_file_info
 static int memcached_chown(const char *path, uid_t uid, gid_t gid, struct fuse_file_info *fi);
 
 static int memcached_link(const char *oldpath, const char *newpath);
+static int memcached_rename(const char *oldpath, const char *newpath, unsigned int flags);
 static int memcached_symlink(const char *linkname, const char *path);
 static int memcached_readlink(const char *path, char *buf, size_t len);
 
+/* mount options: -o connections=N,protocol=ascii|meta,engine=uring|epoll,udp,block_cache_mb=N,writeback_kb=N,
+   readahead_kb=N,block_size=N,inline_size=N,server=host:port[:weight] or server=/unix/socket[:weight]
+   (server can be repeated).
+   udp - block reads go over udp, block_cache_mb - memory for cached blocks (0 disables cache),
+   writeback_kb - dirty data one open file can buffer before it is flushed (0 writes through),
+   readahead_kb - largest window prefetched ahead of sequential reads (0 disables read-ahead),
+   block_size - block size in bytes of new files, up to MAX_FILE_BLOCK_SIZE,
+   inline_size - files up to this size keep content in inode (0 disables inline content).
+   attr_timeout=S,entry_timeout=S,negative_timeout=S - seconds kernel caches attributes, names and missing
+   names, inodes and missing paths are cached in process for attr_timeout and negative_timeout too (0 disables).
+   lazy - paths are resolved from directory records when used instead of all loaded on mount,
+   path_cache=N - most paths lazy mount keeps resolved,
+   lowlevel - fuse low-level interface, kernel passes inode numbers instead of paths */
+static struct options
+{
+    int connections;
+    char *protocol;
+    char *engine;
+    int udp;
+    int block_cache_mb;
+    int writeback_kb;
+    int readahead_kb;
+    int block_size;
+    int inline_size;
+    double attr_timeout;
+    double entry_timeout;
+    double negative_timeout;
+    int lazy;
+    int path_cache;
+    int lowlevel;
+    char **servers;
+    int num_servers;
+} options;
+
+#define OPTION(t, p) {t, offsetof(struct options, p), 1}
+
+enum
+{
+    KEY_SERVER,
+};
+
+static const struct fuse_opt option_spec[] = {
+    OPTION("connections=%d", connections),
+    OPTION("protocol=%s", protocol),
+    OPTION("engine=%s", engine),
+    OPTION("udp", udp),
+    OPTION("block_cache_mb=%d", block_cache_mb),
+    OPTION("writeback_kb=%d", writeback_kb),
+    OPTION("readahead_kb=%d", readahead_kb),
+    OPTION("block_size=%d", block_size),
+    OPTION("inline_size=%d", inline_size),
+    OPTION("attr_timeout=%lf", attr_timeout),
+    OPTION("entry_timeout=%lf", entry_timeout),
+    OPTION("negative_timeout=%lf", negative_timeout),
+    OPTION("lazy", lazy),
+    OPTION("path_cache=%d", path_cache),
+    OPTION("lowlevel", lowlevel),
+    FUSE_OPT_KEY("server=", KEY_SERVER),
+    FUSE_OPT_END};
+
+static int option_proc(void *data, const char *arg, int key, struct fuse_args *outargs)
+{
+    if (key == KEY_SERVER)
+    {
+        options.servers = (char **)realloc(options.servers, (options.num_servers + 1) * sizeof(char *));
+        options.servers[options.num_servers] = strdup(arg + strlen("server="));
+        options.num_servers += 1;
+
+        return 0;
+    }
+
+    return 1;
+}
+
 static struct fuse_operations memcached_oper =
     {
         .init = memcached_init,
@@ -82,825 +191,3585 @@ static struct fuse_operations memcached_oper =
         .chmod = memcached_chmod,
         .chown = memcached_chown,
         .link = memcached_link,
+        .rename = memcached_rename,
         .symlink = memcached_symlink,
         .readlink = memcached_readlink};
 
-static void add_link_to_parent_dir(char *path)
-{
-    char *parent_dir = get_parent_directory(path);
+/* decodes record read from server (data, NULL if inode does not exist), text records of older versions are
+   upgraded, and caches it unless put_inode cached newer record meanwhile. record is set to buffer inode points
+   into. returns 0, -1 if inode does not exist */
 
-    int inode_value = hashable_get_entry(parent_dir);
-
-    if (inode_value == -1)
+static int decode_inode(int inode_value, char *data, size_t size, inode_t *inode, char **record)
+{
+    if (data == NULL)
     {
-        printf("could not find path: %s\n", path);
+        return -1;
     }
 
-    char *inode_key = int_to_string(inode_value);
-
-    char *block_key = block_key_to_string(inode_value, 0);
-
-    char *links = memcached_get(block_key);
-
-    char *link_name = get_name_from_path(path);
-    size_t link_size = strlen(link_name);
-
-    if (links == NULL) // first link
+    if (inode_decode(data, size, inode) != 0)
     {
-        char link[link_size + 2];
-        memcpy(link, link_name, link_size);
-        link[link_size] = '\n';
-        link[link_size + 1] = '\0';
-
-        memcached_set(block_key, link, strlen(link));
-    }
-    else
-    {
-        size_t links_size = strlen(links);
-
-        char updated_links[links_size + link_size + 2];
-
-        memcpy(updated_links, links, links_size);
-        memcpy(updated_links + links_size, link_name, link_size);
-        updated_links[links_size + link_size] = '\n';
-        updated_links[links_size + link_size + 1] = '\0';
-
-        memcached_set(block_key, updated_links, strlen(updated_links));
+        char *upgraded = inode_upgrade(data, &size);
+        free(data);
+        data = upgraded;
 
-        free(links);
+        if (data == NULL || inode_decode(data, size, inode) != 0)
+        {
+            free(data);
+            return -1;
+        }
     }
 
-    free(link_name);
-
-    char *attribute_data = memcached_get(inode_key);
-    unsigned long st_blocks = get_attr_value(attribute_data, "st_blocks");
-    char *data_with_blocks = modify_attr(attribute_data, "st_blocks", st_blocks + 1);
-    memcached_set(inode_key, data_with_blocks, strlen(data_with_blocks));
+    inode_cache_add(inode_value, data, size);
 
-    free(attribute_data);
-    free(data_with_blocks);
+    *record = data;
 
-    free(parent_dir);
-    free(inode_key);
-    free(block_key);
+    return 0;
 }
 
-static void remove_link_from_parent_dir(char *path)
-{
-    char *parent_dir = get_parent_directory(path);
+/* reads and decodes inode (from inode cache if it is there), text records of older versions are upgraded.
+   record is set to buffer inode points into (freed by caller). returns 0, -1 if inode does not exist */
 
-    int inode_value = hashable_get_entry(parent_dir);
+static int get_inode(int inode_value, inode_t *inode, char **record)
+{
+    size_t size = 0;
+    char *data = inode_cache_get(inode_value, &size);
 
-    if (inode_value == -1)
+    if (data != NULL && inode_decode(data, size, inode) == 0)
     {
-        printf("could not find path: %s\n", path);
+        *record = data;
+        return 0;
     }
 
-    char *inode_key = int_to_string(inode_value);
-
-    char *block_key = block_key_to_string(inode_value, 0);
+    free(data);
 
-    char *links = memcached_get(block_key);
-
-    char *link_name = get_name_from_path(path);
-    size_t link_size = strlen(link_name);
-
-    if (links != NULL) // should always be true
-    {
-        size_t links_size = strlen(links);
-        char *link = strstr(links, link_name);
-
-        int index_of_link = (link - links) / sizeof(char);
-
-        char updated_links[links_size - link_size + 2];
-
-        memcpy(updated_links, links, index_of_link);
-        memcpy(updated_links + index_of_link, links + index_of_link + link_size + 1, links_size - index_of_link - link_size + 1);
-        updated_links[links_size - link_size + 1] = '\0';
+    char *inode_key = int_to_string(inode_value);
+    data = memcached_get_sized(inode_key, &size);
 
-        memcached_set(block_key, updated_links, strlen(updated_links));
+    free(inode_key);
 
-        free(links);
-    }
+    return decode_inode(inode_value, data, size, inode, record);
 }
 
-// content is null if not symlink - otherwise  path to original file
-static int create_inode(char *path, mode_t mode, nlink_t nlink, uid_t uid, gid_t gid, off_t size, char *content)
+/* get_inode for entries of readdirplus: cached inodes are taken from inode cache, all others are read with one
+   multi-get. records[i] is NULL if inode_values[i] does not exist */
+
+static void get_inodes(int *inode_values, int count, inode_t *inodes, char **records)
 {
-    char *ino_value = memcached_get("inode_value");
-    int ino = atoi(ino_value);
-    free(ino_value);
-
-    char *st_ino = get_attr_pair("st_ino", ino);
-    char *st_mode = get_attr_pair("st_mode", mode);
-    char *st_uid = get_attr_pair("st_uid", uid);
-    char *st_gid = get_attr_pair("st_gid", gid);
-    char *st_nlink = get_attr_pair("st_nlink", nlink);
-    char *st_size = get_attr_pair("st_size", size);
-    char *st_blocks = get_attr_pair("st_blocks", 0);
-
-    size_t inode_length = strlen(st_ino) + strlen(st_mode) + strlen(st_uid) + strlen(st_gid) + strlen(st_nlink) + strlen(st_size) + strlen(st_blocks);
-    char *inode = (char *)malloc(inode_length + 1);
-    inode[0] = '\0';
-
-    strcat(inode, st_ino);
-    strcat(inode, st_mode);
-    strcat(inode, st_uid);
-    strcat(inode, st_gid);
-    strcat(inode, st_nlink);
-    strcat(inode, st_size);
-    strcat(inode, st_blocks);
-
-    free(st_ino);
-    free(st_mode);
-    free(st_uid);
-    free(st_gid);
-    free(st_nlink);
-    free(st_size);
-    free(st_blocks);
+    char **keys = (char **)malloc(count * sizeof(char *));
+    char **values = (char **)malloc(count * sizeof(char *));
+    size_t *sizes = (size_t *)malloc(count * sizeof(size_t));
+    int *missing = (int *)malloc(count * sizeof(int));
 
-    if (content != NULL) // symlink
+    int num_missing = 0;
+
+    for (int i = 0; i < count; i++)
     {
-        char *content_key = "st_content\n";
-        inode = (char *)realloc(inode, inode_length + 1 + strlen(content) + strlen(content_key) + 1);
-        strcat(inode, content_key);
-        strcat(inode, content);
-        strcat(inode, "\n");
-    }
+        size_t size = 0;
+        records[i] = inode_cache_get(inode_values[i], &size);
 
-    char *key = int_to_string(ino);
-    int set = memcached_set(key, inode, strlen(inode));
+        if (records[i] != NULL && inode_decode(records[i], size, &inodes[i]) == 0)
+        {
+            continue;
+        }
 
-    char *new_inode_value = int_to_string(ino + 1);
-    memcached_set("inode_value", new_inode_value, strlen(new_inode_value));
-    free(new_inode_value);
+        free(records[i]);
+        records[i] = NULL;
 
-    free(key);
-    free(inode);
+        keys[num_missing] = int_to_string(inode_values[i]);
+        missing[num_missing++] = i;
+    }
 
-    if (set == 1)
+    if (num_missing > 0 && memcached_get_multi_sized(keys, num_missing, values, sizes) >= 0)
     {
-        hashtable_add_entry((char *)path, ino);
-
-        char *inode_table = memcached_get("inode_table");
-        char *new_inode_table = add_inode_to_table(inode_table, (char *)path, ino);
-        memcached_set("inode_table", new_inode_table, strlen(new_inode_table)); // what if > 1024
-
-        // ADDING NEW LINK TO DIRECTORY BLOCK
-        if (path != "/")
+        for (int j = 0; j < num_missing; j++)
         {
-            add_link_to_parent_dir(path);
+            int i = missing[j];
+            decode_inode(inode_values[i], values[j], sizes[j], &inodes[i], &records[i]);
         }
+    }
 
-        free(inode_table);
-        free(new_inode_table);
-
-        return 0;
+    for (int j = 0; j < num_missing; j++)
+    {
+        free(keys[j]);
     }
 
-    return -1;
+    free(keys);
+    free(values);
+    free(sizes);
+    free(missing);
 }
 
-static int delete_inode(char *path)
-{
-    char *inode_table = memcached_get("inode_table");
-    char *new_inode_table = remove_inode_from_table(inode_table, path);
-    memcached_set("inode_table", new_inode_table, strlen(inode_table));
-
-    free(inode_table);
-    free(new_inode_table);
+/* returns 1 if inode was stored */
 
-    int inode_value = hashtable_remove_entry(path);
+static int put_inode(int inode_value, inode_t *inode)
+{
+    size_t size = 0;
+    char *data = inode_encode(inode, &size);
 
-    // remove from memcached server this inode with its blocks
     char *inode_key = int_to_string(inode_value);
-    char *attribute_data = memcached_get(inode_key);
+    int set = memcached_set(inode_key, data, size);
 
-    unsigned long st_nlink = get_attr_value(attribute_data, "st_nlink");
-
-    unsigned long st_mode = get_attr_value(attribute_data, "st_mode");
-
-    if (S_ISREG(st_mode) && st_nlink > 1) // hard link
+    // cache is written through, inode that may not be stored is dropped from it
+    if (set == 1)
     {
-        // do not delete blocks
-        char *modified_data = modify_attr(attribute_data, "st_nlink", st_nlink - 1);
-        memcached_set(inode_key, modified_data, strlen(modified_data));
-
-        free(modified_data);
-
-        remove_link_from_parent_dir(path);
+        inode_cache_put(inode_value, data, size);
     }
     else
     {
-        unsigned long st_blocks = get_attr_value(attribute_data, "st_blocks");
-
-        for (int i = 0; i < st_blocks; i++)
-        {
-            char *block_key = block_key_to_string(inode_value, i);
-            memcached_delete(block_key);
-            free(block_key);
-        }
-
-        memcached_delete(inode_key);
-        remove_link_from_parent_dir(path);
+        inode_cache_invalidate(inode_value);
     }
 
     free(inode_key);
-    free(attribute_data);
+    free(data);
 
-    return 0;
+    return set;
 }
 
-static void *memcached_init(struct fuse_conn_info *conn,
-                            struct fuse_config *cfg)
-{
-    printf("init \n");
-
-    memcached_connect();
+/* block size of file, inodes stored before block size was recorded use FILE_BLOCK_SIZE */
 
-    char *inode_table = memcached_get("inode_table");
+static int inode_block_size(inode_t *inode)
+{
+    return (inode->attrs.st_blksize == 0) ? FILE_BLOCK_SIZE : inode->attrs.st_blksize;
+}
 
-    if (inode_table == NULL) // no filesystem stored in memcached
-    {
-        memcached_flush_all();
+static void fill_stat(inode_t *inode, struct stat *stbuf)
+{
+    stbuf->st_ino = inode->attrs.st_ino;
+    stbuf->st_mode = inode->attrs.st_mode;
+    stbuf->st_uid = inode->attrs.st_uid;
+    stbuf->st_gid = inode->attrs.st_gid;
+    stbuf->st_nlink = inode->attrs.st_nlink;
+    stbuf->st_size = inode->attrs.st_size;
+    stbuf->st_blocks = inode->attrs.st_blocks;
+    stbuf->st_blksize = inode_block_size(inode);
+}
 
-        hashtable_init();
-        memcached_set("inode_table", "", 0);
-        memcached_set("inode_value", "0", 1);
+/* directory record (block 0 of directory), NULL if directory has no entries. record holds entries of small
+   directory, record of directory with more than DENTRY_RECORD_MAX bytes of entries is "/buckets N S\n" (names
+   can not contain '/') and entries are in blocks 0..N-1 of id S, entry is in bucket picked by top bits of its
+   hash. records split before buckets had their own id are "/buckets N\n", with buckets in blocks 1..N */
 
-        int set = create_inode("/", S_IFDIR | 0755, 2, getuid(), getgid(), 0, NULL);
-    }
-    else
-    {
+static char *get_dentries(int dir_value)
+{
+    char *block_key = block_key_to_string(dir_value, 0);
+    char *dentries = memcached_get(block_key);
 
-        hashtable_string_to_table(inode_table);
-    }
+    free(block_key);
 
-    return NULL;
+    return dentries;
 }
 
-static int memcached_getattr(const char *path, struct stat *stbuf,
-                             struct fuse_file_info *fi)
-{
-    printf("get attr %s\n", path);
-
-    int inode_value = hashable_get_entry((char *)path);
-
-    if (inode_value == -1)
-    {
-        // this path does not exist
-        return -ENOENT;
-    }
+/* number of buckets of directory, 0 if its record holds entries itself. split is set to id blocks of buckets
+   belong to, -1 if they are blocks of directory */
 
-    char *inode_key = int_to_string(inode_value);
-    char *attribute_data = memcached_get(inode_key);
+static int dentry_buckets(char *record, int *split)
+{
+    int buckets = 0;
+    *split = -1;
 
-    if (attribute_data != NULL)
+    if (record != NULL && record[0] == '/')
     {
-        stbuf->st_ino = get_attr_value(attribute_data, "st_ino");
-        stbuf->st_mode = get_attr_value(attribute_data, "st_mode");
-        stbuf->st_uid = get_attr_value(attribute_data, "st_uid");
-        stbuf->st_gid = get_attr_value(attribute_data, "st_gid");
-        stbuf->st_nlink = get_attr_value(attribute_data, "st_nlink");
-        stbuf->st_size = get_attr_value(attribute_data, "st_size");
-        stbuf->st_blocks = get_attr_value(attribute_data, "st_blocks");
-
-        free(attribute_data);
-        free(inode_key);
+        sscanf(record, "/buckets %d %d", &buckets, split);
     }
 
-    return 0;
+    return buckets;
 }
 
-static int memcached_mkdir(const char *path, mode_t mode)
+static char *bucket_key(int dir_value, int split, int bucket)
 {
-    printf("mkdir: %s\n", path);
+    return (split == -1) ? block_key_to_string(dir_value, 1 + bucket) : block_key_to_string(split, bucket);
+}
 
-    int set = create_inode((char *)path, S_IFDIR | mode, 2, getuid(), getgid(), 0, NULL);
+/* buckets are in hash order, so readdir reads them one after another */
 
-    return 0;
+static int dentry_bucket(uint64_t hash, int buckets)
+{
+    return (int)(((hash >> 31) * buckets) >> 30);
 }
 
-static int memcached_rmdir(const char *path)
+/* directory records keep one entry per line, name with newline would be read back as other entries. works for
+   paths too, as their names can not have newline */
+
+static int valid_name(const char *name)
 {
-    int inode_value = hashable_get_entry((char *)path);
-    char *inode_key = int_to_string(inode_value);
+    return strchr(name, '\n') == NULL;
+}
+
+/* inode (and type) of name in directory, -1 if there is no such entry */
 
-    char *block_key = block_key_to_string(inode_value, 0);
-    char *links = memcached_get(block_key);
+static int find_dentry(int dir_value, const char *name, int *type)
+{
+    char *dentries = get_dentries(dir_value);
+    int split = -1;
+    int buckets = dentry_buckets(dentries, &split);
 
-    if (links != NULL && strlen(links) > 0)
+    if (buckets > 0)
     {
-        free(links);
-        free(block_key);
-        free(inode_key);
+        free(dentries);
 
-        return -ENOTEMPTY;
+        char *block_key = bucket_key(dir_value, split, dentry_bucket(dentry_hash(name), buckets));
+        dentries = memcached_get(block_key);
+        free(block_key);
     }
 
-    delete_inode((char *)path);
+    int inode_value = dentries_find(dentries, (char *)name, type);
 
-    free(links);
-    free(block_key);
-    free(inode_key);
+    free(dentries);
 
-    return 0;
+    return inode_value;
 }
 
-static int memcached_opendir(const char *path, struct fuse_file_info *fi)
+typedef int (*dentry_filler)(void *ctx, dentry *entry);
+
+static int fill_sorted(char *dentries, uint64_t from, dentry_filler fill, void *ctx)
 {
-    int inode_value = hashable_get_entry((char *)path);
+    dentry *entries = NULL;
+    int count = dentries_sorted(dentries, &entries);
+    int stopped = 0;
 
-    if (inode_value == -1)
+    for (int i = 0; i < count && !stopped; i++)
     {
-        // this path does not exist
-        return -ENOENT;
+        if (entries[i].hash >= from)
+        {
+            stopped = fill(ctx, &entries[i]);
+        }
     }
 
-    return 0;
+    free(entries);
+
+    return stopped;
 }
 
-static int memcached_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t off, struct fuse_file_info *fi, enum fuse_readdir_flags flags)
+/* passes entries of directory with hash from and above to fill in hash order, until fill returns non-zero.
+   buckets are read starting with bucket of from, one and then twice as many per request (up to
+   DENTRY_BATCH_MAX), so resumed readdir of big directory reads about as much as it returns. returns 1 if fill
+   stopped walk */
+
+static int walk_dentries(int dir_value, uint64_t from, dentry_filler fill, void *ctx)
 {
-    filler(buf, ".", NULL, 0, 0);
-    filler(buf, "..", NULL, 0, 0);
+    char *dentries = get_dentries(dir_value);
+    int split = -1;
+    int buckets = dentry_buckets(dentries, &split);
 
-    // get links and parse
-    int inode_value = hashable_get_entry((char *)path);
-    char *inode_key = int_to_string(inode_value);
+    if (buckets == 0)
+    {
+        int stopped = fill_sorted(dentries, from, fill, ctx);
 
-    char *block_key = block_key_to_string(inode_value, 0);
+        free(dentries);
 
-    char *links = memcached_get(block_key);
+        return stopped;
+    }
+
+    free(dentries);
+
+    char *keys[DENTRY_BATCH_MAX];
+    char *values[DENTRY_BATCH_MAX];
+
+    int batch = 1;
 
-    if (links != NULL)
+    for (int first = dentry_bucket(from, buckets); first < buckets; first += batch, batch *= (batch < DENTRY_BATCH_MAX) ? 2 : 1)
     {
-        char c = 'c';
-        int index = 0;
-        int size = 0;
+        int count = (buckets - first < batch) ? buckets - first : batch;
 
-        while (c != '\0')
+        for (int i = 0; i < count; i++)
         {
-            c = links[index];
-            if (c == '\n')
-            {
-                char link[size + 1];
-                link[size] = '\0';
-                memcpy(link, links + index - size, size);
-                filler(buf, link, NULL, 0, 0);
-                size = 0;
-            }
-            else
+            keys[i] = bucket_key(dir_value, split, first + i);
+        }
+
+        memcached_get_multi(keys, count, values);
+
+        int stopped = 0;
+
+        for (int i = 0; i < count; i++)
+        {
+            if (!stopped)
             {
-                size += 1;
+                stopped = fill_sorted(values[i], from, fill, ctx);
             }
 
-            index += 1;
+            free(keys[i]);
+            free(values[i]);
+        }
+
+        if (stopped)
+        {
+            return 1;
         }
     }
 
     return 0;
 }
 
-static int memcached_releasedir(const char *path, struct fuse_file_info *fi)
-{
-    return 0;
-}
+/* inode of path, -1 if it does not exist. lazy mount resolves paths missing in path index from record of their
+   parent directory (resolving parent first the same way) and adds them to index */
 
-static int memcached_fsyncdir(const char *path, int datasync, struct fuse_file_info *fi)
+static int lookup_path(const char *path)
 {
-    return 0;
-}
+    if (strcmp(path, "/") == 0)
+    {
+        return ROOT_INODE;
+    }
 
-static int memcached_unlink(const char *path)
-{
-    delete_inode((char *)path);
+    int inode_value = hashable_get_entry((char *)path);
 
-    return 0;
-}
+    if (inode_value != -1 || !options.lazy)
+    {
+        return inode_value;
+    }
 
-static int memcached_create(const char *path, mode_t mode, struct fuse_file_info *fi)
-{
     char *parent_dir = get_parent_directory(path);
+    int parent_value = lookup_path(parent_dir);
+
     free(parent_dir);
 
-    int set = create_inode((char *)path, mode, 1, getuid(), getgid(), 0, NULL);
+    if (parent_value == -1)
+    {
+        return -1;
+    }
 
-    return 0;
-}
+    char *name = get_name_from_path(path);
+    inode_value = find_dentry(parent_value, name, NULL);
 
-static int memcached_open(const char *path, struct fuse_file_info *fi) // ???
-{
-    int inode_value = hashable_get_entry((char *)path);
+    free(name);
 
-    if (inode_value == -1)
+    if (inode_value != -1)
     {
-        // this path does not exist
-        return -ENOENT;
+        hashtable_add_entry((char *)path, inode_value);
     }
 
-    return 0;
+    return inode_value;
 }
 
-static int memcached_read(const char *path, char *buf, size_t size, off_t offset,
-                          struct fuse_file_info *fi)
-{
-    int inode_value = hashable_get_entry((char *)path);
+/* readdir passes entries with their attributes to fill, stbuf is NULL without readdirplus (and for entry whose
+   inode is gone). offsets: "." is 1, ".." is 2 and entry is its hash + 3, so readdir resumes after last entry it
+   returned, even if entries were added or removed in meantime */
 
-    char *inode_key = int_to_string(inode_value);
-    char *attribute_data = memcached_get(inode_key);
+typedef int (*readdir_filler)(void *ctx, dentry *entry, struct stat *stbuf);
 
-    unsigned long st_size = get_attr_value(attribute_data, "st_size");
+typedef struct readdir_batch
+{
+    readdir_filler fill;
+    void *ctx;
+    dentry *entries; /* entries waiting for their inodes, NULL without readdirplus */
+    int count;
+} readdir_batch;
 
-    if (st_size <= offset) // offset at or beyond end of file
-    {
-        return 0;
-    }
+/* inodes of entries in batch are read with one multi-get, so ls -l of big directory takes a round trip per
+   READDIRPLUS_BATCH entries instead of getattr per entry */
 
-    if (offset + size > st_size)
+static int fill_batch(readdir_batch *batch)
+{
+    int inode_values[READDIRPLUS_BATCH];
+    inode_t inodes[READDIRPLUS_BATCH];
+    char *records[READDIRPLUS_BATCH];
+
+    for (int i = 0; i < batch->count; i++)
     {
-        size = st_size - offset;
+        inode_values[i] = batch->entries[i].inode_value;
     }
 
-    file_blocks_t *block_info = get_file_blocks_info(offset, size, FILE_BLOCK_SIZE);
+    get_inodes(inode_values, batch->count, inodes, records);
 
-    size_t already_read_bytes = 0;
+    int stopped = 0;
 
-    for (int i = 0; i < block_info->num_blocks; i++)
+    for (int i = 0; i < batch->count; i++)
     {
-        int current_block_num = block_info->start_block + i;
-        char *block_key = block_key_to_string(inode_value, current_block_num);
+        struct stat stbuf;
+        memset(&stbuf, 0, sizeof(struct stat));
 
-        char *data = memcached_get(block_key);
-
-        if (data == NULL)
+        if (records[i] != NULL)
         {
-            data = (char *)malloc(FILE_BLOCK_SIZE + 1);
-            memset(data, 0, FILE_BLOCK_SIZE);
-            data[FILE_BLOCK_SIZE] = '\0';
+            fill_stat(&inodes[i], &stbuf);
         }
 
-        size_t read_offset = (i == 0) ? block_info->offset_in_start_block : 0;
-
-        if (i == 0 && block_info->num_blocks == 1)
+        if (!stopped)
         {
-            memcpy(buf, data + read_offset, size);
-        }
-        else if (i == 0 && block_info->num_blocks > 1)
-        {
-            size_t read_size = FILE_BLOCK_SIZE - read_offset;
-            memcpy(buf, data + read_offset, read_size);
-            already_read_bytes += read_size;
-        }
-        else // i != 0
-        {
-            size_t read_size = (i == block_info->num_blocks - 1) ? block_info->bytes_in_end_block : FILE_BLOCK_SIZE;
-            memcpy(buf + already_read_bytes, data + read_offset, read_size);
-            already_read_bytes += read_size;
+            stopped = batch->fill(batch->ctx, &batch->entries[i], (records[i] != NULL) ? &stbuf : NULL);
         }
 
-        free(block_key);
-        free(data);
+        free(records[i]);
     }
 
-    free(block_info);
+    batch->count = 0;
 
-    return size;
+    return stopped;
 }
 
-static int memcached_write(const char *path, const char *buf, size_t size, off_t offset,
-                           struct fuse_file_info *fi)
+static int batch_dentry(void *ctx, dentry *entry)
 {
-    int inode_value = hashable_get_entry((char *)path);
+    readdir_batch *batch = (readdir_batch *)ctx;
 
-    file_blocks_t *block_info = get_file_blocks_info(offset, size, FILE_BLOCK_SIZE);
+    if (batch->entries == NULL)
+    {
+        return batch->fill(batch->ctx, entry, NULL);
+    }
 
-    size_t written_bytes = 0;
+    batch->entries[batch->count++] = *entry;
 
-    for (int i = 0; i < block_info->num_blocks; i++)
+    return (batch->count == READDIRPLUS_BATCH) ? fill_batch(batch) : 0;
+}
+
+/* passes entries of directory after offset off to fill, until fill returns non-zero */
+
+static void readdir_dentries(int dir_value, off_t off, int plus, readdir_filler fill, void *ctx)
+{
+    readdir_batch batch = {fill, ctx, NULL, 0};
+
+    if (plus)
     {
-        int current_block_num = block_info->start_block + i;
-        char *block_key = block_key_to_string(inode_value, current_block_num);
+        batch.entries = (dentry *)malloc(READDIRPLUS_BATCH * sizeof(dentry));
+    }
 
-        char *data = memcached_get(block_key);
+    if (!walk_dentries(dir_value, (off < 2) ? 0 : off - 2, batch_dentry, &batch) && batch.count > 0)
+    {
+        fill_batch(&batch);
+    }
 
-        if (data == NULL) // this block does not exist
-        {
-            data = (char *)malloc(FILE_BLOCK_SIZE + 1);
-            memset(data, 0, FILE_BLOCK_SIZE);
-            data[FILE_BLOCK_SIZE] = '\0';
-        }
+    free(batch.entries);
+}
 
-        size_t write_offset = (i == 0) ? block_info->offset_in_start_block : 0;
+static int allocate_inode();
 
-        if (i == 0 && block_info->num_blocks == 1)
-        {
-            memcpy(data + write_offset, buf, size);
-        }
-        else if (i == 0 && block_info->num_blocks > 1)
+/* splits record of directory into DENTRY_BUCKETS buckets. buckets are stored under new id, empty ones too,
+   before record is replaced with number of buckets and that id, so nobody uses buckets before they are
+   complete. splits racing for same record never write each others buckets: buckets of split that lost its cas
+   are not reachable and are deleted. record stays whole if buckets can not be stored. returns result of cas of
+   record */
+
+static int split_dentries(int dir_value, char *dentries, unsigned long long cas)
+{
+    char **keys = (char **)malloc(DENTRY_BUCKETS * sizeof(char *));
+    char **values = (char **)calloc(DENTRY_BUCKETS, sizeof(char *));
+    size_t *counts = (size_t *)malloc(DENTRY_BUCKETS * sizeof(size_t));
+
+    char name[NAME_MAX + 1];
+    int inode_value;
+    int type;
+
+    char *cursor = dentries;
+
+    while ((cursor = dentries_next(cursor, name, &inode_value, &type)) != NULL)
+    {
+        int bucket = dentry_bucket(dentry_hash(name), DENTRY_BUCKETS);
+        char *bucket_dentries = dentries_add(values[bucket], name, inode_value, type);
+
+        free(values[bucket]);
+        values[bucket] = bucket_dentries;
+    }
+
+    int split = allocate_inode();
+
+    for (int i = 0; i < DENTRY_BUCKETS; i++)
+    {
+        keys[i] = bucket_key(dir_value, split, i);
+        values[i] = (values[i] != NULL) ? values[i] : strdup("");
+        counts[i] = strlen(values[i]);
+    }
+
+    char *record = dentries;
+    char header[48];
+
+    if (split != -1 && memcached_set_multi(keys, values, counts, DENTRY_BUCKETS) == 0)
+    {
+        snprintf(header, sizeof(header), "/buckets %d %d\n", DENTRY_BUCKETS, split);
+        record = header;
+    }
+
+    char *block_key = block_key_to_string(dir_value, 0);
+    int stored = memcached_cas(block_key, record, strlen(record), cas);
+
+    free(block_key);
+
+    if (record == header && stored != 1)
+    {
+        memcached_delete_multi(keys, DENTRY_BUCKETS);
+    }
+
+    for (int i = 0; i < DENTRY_BUCKETS; i++)
+    {
+        free(keys[i]);
+        free(values[i]);
+    }
+
+    free(keys);
+    free(values);
+    free(counts);
+
+    return stored;
+}
+
+/* adds entry to directory (replacing entry with same name) or removes it (inode_value -1). record, or bucket of
+   entry once record is split, is updated with cas, so entries added at same time by other threads and mounts
+   are not lost. only bucket of entry is rewritten, so big directory takes about as long as small one.
+   returns 0 or -EIO if record can not be stored */
+
+static int update_dentries(int dir_value, char *link_name, int inode_value, int type)
+{
+    char *block_key = block_key_to_string(dir_value, 0);
+    int in_bucket = 0;
+    int result = 0;
+
+    while (1)
+    {
+        unsigned long long cas = 0;
+        char *dentries = memcached_gets(block_key, &cas);
+
+        int split = -1;
+        int buckets = in_bucket ? 0 : dentry_buckets(dentries, &split);
+
+        if (buckets > 0) // record is split, bucket of entry is updated instead
         {
-            size_t write_size = FILE_BLOCK_SIZE - write_offset;
-            memcpy(data + write_offset, buf + written_bytes, write_size);
-            written_bytes += write_size;
+            free(dentries);
+            free(block_key);
+
+            block_key = bucket_key(dir_value, split, dentry_bucket(dentry_hash(link_name), buckets));
+            in_bucket = 1;
+
+            continue;
         }
-        else // i != 0
+
+        char *updated = NULL;
+
+        if (inode_value != -1)
+        {
+            char *replaced = (dentries != NULL) ? dentries_remove(dentries, link_name) : NULL;
+
+            updated = dentries_add((replaced != NULL) ? replaced : dentries, link_name, inode_value, type);
+
+            free(replaced);
+        }
+        else if (dentries != NULL)
+        {
+            updated = dentries_remove(dentries, link_name);
+        }
+
+        if (updated == NULL) // nothing to remove
+        {
+            free(dentries);
+            break;
+        }
+
+        int stored;
+
+        if (dentries == NULL) // first entry
+        {
+            stored = memcached_add(block_key, updated, strlen(updated));
+        }
+        else if (!in_bucket && strlen(updated) > DENTRY_RECORD_MAX)
+        {
+            stored = split_dentries(dir_value, updated, cas);
+        }
+        else
+        {
+            stored = memcached_cas(block_key, updated, strlen(updated), cas);
+        }
+
+        free(dentries);
+        free(updated);
+
+        if (stored == -1)
+        {
+            result = -EIO;
+            break;
+        }
+
+        if (stored == 1) // 0 means record changed since it was read
+        {
+            break;
+        }
+    }
+
+    free(block_key);
+
+    return result;
+}
+
+static int update_parent_dir(char *path, int inode_value, int type)
+{
+    char *parent_dir = get_parent_directory(path);
+    int parent_value = lookup_path(parent_dir);
+
+    free(parent_dir);
+
+    if (parent_value == -1)
+    {
+        printf("could not find path: %s\n", path);
+        return -ENOENT;
+    }
+
+    char *link_name = get_name_from_path(path);
+
+    int result = update_dentries(parent_value, link_name, inode_value, type);
+
+    free(link_name);
+
+    return result;
+}
+
+static int add_link_to_parent_dir(char *path, int inode_value, mode_t mode)
+{
+    return update_parent_dir(path, inode_value, IFTODT(mode));
+}
+
+static int remove_link_from_parent_dir(char *path)
+{
+    return update_parent_dir(path, -1, DT_UNKNOWN);
+}
+
+static void load_directory(char *path, int inode_value);
+
+static int load_dentry(void *ctx, dentry *entry)
+{
+    char *entry_path = construct_path((char *)ctx, entry->name);
+
+    hashtable_add_entry(entry_path, entry->inode_value);
+
+    if (entry->type == DT_DIR)
+    {
+        load_directory(entry_path, entry->inode_value);
+    }
+
+    free(entry_path);
+
+    return 0;
+}
+
+/* adds paths of directory entries (and entries of its subdirectories) to path index */
+
+static void load_directory(char *path, int inode_value)
+{
+    walk_dentries(inode_value, 0, load_dentry, path);
+}
+
+/* entries of one directory collected while older inode_table is converted */
+typedef struct dir_listing
+{
+    int inode_value;
+    char *dentries;
+    UT_hash_handle hh;
+} dir_listing;
+
+/* filesystems of older versions keep all paths in one "inode_table" value (loaded into path index before this
+   is called) and names without inodes in directory blocks. every directory record is rewritten with inodes and
+   types of its entries and inode_table is deleted */
+
+static void upgrade_inode_table()
+{
+    dir_listing *listings = NULL;
+    hashable *entry, *tmp;
+
+    HASH_ITER(hh, inode_table, entry, tmp)
+    {
+        if (strcmp(entry->key, "/") == 0)
+        {
+            continue;
+        }
+
+        char *parent_dir = get_parent_directory(entry->key);
+        int parent_value = hashable_get_entry(parent_dir);
+
+        free(parent_dir);
+
+        inode_t inode;
+        char *record = NULL;
+
+        if (parent_value == -1 || get_inode(entry->inode_value, &inode, &record) != 0)
+        {
+            continue;
+        }
+
+        dir_listing *listing = NULL;
+        HASH_FIND_INT(listings, &parent_value, listing);
+
+        if (listing == NULL)
+        {
+            listing = (dir_listing *)calloc(1, sizeof(dir_listing));
+            listing->inode_value = parent_value;
+            HASH_ADD_INT(listings, inode_value, listing);
+        }
+
+        char *name = get_name_from_path(entry->key);
+        char *dentries = dentries_add(listing->dentries, name, entry->inode_value, IFTODT(inode.attrs.st_mode));
+
+        free(listing->dentries);
+        listing->dentries = dentries;
+
+        free(name);
+        free(record);
+    }
+
+    dir_listing *listing, *next;
+
+    HASH_ITER(hh, listings, listing, next)
+    {
+        char *block_key = block_key_to_string(listing->inode_value, 0);
+        memcached_set(block_key, listing->dentries, strlen(listing->dentries));
+        free(block_key);
+
+        HASH_DEL(listings, listing);
+        free(listing->dentries);
+        free(listing);
+    }
+
+    memcached_delete("inode_table");
+}
+
+/* Inode ids are leased from "inode_value" counter with incr, INODE_LEASE_SIZE at a time, so every mount
+   (and every thread) gets ids nobody else uses without a round trip per inode. inode_lease keeps next
+   free id of lease in low 32 bits and end of lease in high 32 bits, ids are taken with compare and swap. */
+static unsigned long long inode_lease = 0;
+static pthread_mutex_t inode_lease_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int allocate_inode()
+{
+    while (1)
+    {
+        unsigned long long lease = __atomic_load_n(&inode_lease, __ATOMIC_ACQUIRE);
+        unsigned int next = (unsigned int)lease;
+        unsigned int end = (unsigned int)(lease >> 32);
+
+        if (next < end)
+        {
+            if (__atomic_compare_exchange_n(&inode_lease, &lease, lease + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            {
+                return next;
+            }
+            continue;
+        }
+
+        pthread_mutex_lock(&inode_lease_lock);
+
+        if (__atomic_load_n(&inode_lease, __ATOMIC_ACQUIRE) == lease) // not renewed by other thread in meantime
+        {
+            unsigned long long value = 0;
+
+            if (memcached_incr("inode_value", INODE_LEASE_SIZE, &value) != 1)
+            {
+                pthread_mutex_unlock(&inode_lease_lock);
+                return -1;
+            }
+
+            __atomic_store_n(&inode_lease, (value << 32) | (value - INODE_LEASE_SIZE), __ATOMIC_RELEASE);
+        }
+
+        pthread_mutex_unlock(&inode_lease_lock);
+    }
+}
+
+// content is null if not symlink - otherwise  path to original file
+static int init_inode(int ino, mode_t mode, nlink_t nlink, uid_t uid, gid_t gid, off_t size, char *content)
+{
+    inode_t inode;
+    memset(&inode, 0, sizeof(inode_t));
+
+    inode.attrs.st_ino = ino;
+    inode.attrs.st_mode = mode;
+    inode.attrs.st_uid = uid;
+    inode.attrs.st_gid = gid;
+    inode.attrs.st_nlink = nlink;
+    inode.attrs.st_size = size;
+    inode.attrs.st_blksize = options.block_size;
+
+    if (S_ISREG(mode) && options.inline_size > 0)
+    {
+        inode.attrs.flags |= INODE_INLINE;
+    }
+
+    if (content != NULL) // symlink
+    {
+        inode.content = content;
+        inode.attrs.content_size = strlen(content);
+    }
+
+    return put_inode(ino, &inode);
+}
+
+/* deletes inode that could not be linked into its directory */
+
+static void discard_inode(int ino)
+{
+    char *inode_key = int_to_string(ino);
+    memcached_delete(inode_key);
+    free(inode_key);
+
+    inode_cache_invalidate(ino);
+}
+
+/* new inode linked as name into directory dir_value, returns its id or -1 */
+
+static int make_inode(int dir_value, char *name, mode_t mode, nlink_t nlink, uid_t uid, gid_t gid, off_t size,
+                      char *content)
+{
+    int ino = allocate_inode();
+
+    if (ino == -1 || init_inode(ino, mode, nlink, uid, gid, size, content) != 1)
+    {
+        return -1;
+    }
+
+    if (update_dentries(dir_value, name, ino, IFTODT(mode)) != 0)
+    {
+        discard_inode(ino);
+        return -1;
+    }
+
+    return ino;
+}
+
+/* new inode linked as path, returns its id, -EEXIST if path exists or -EIO */
+
+static int create_inode(char *path, mode_t mode, nlink_t nlink, uid_t uid, gid_t gid, off_t size, char *content)
+{
+    if (lookup_path(path) != -1)
+    {
+        return -EEXIST;
+    }
+
+    int ino = allocate_inode();
+
+    if (ino == -1 || init_inode(ino, mode, nlink, uid, gid, size, content) != 1)
+    {
+        return -EIO;
+    }
+
+    hashtable_add_entry((char *)path, ino);
+
+    if (add_link_to_parent_dir(path, ino, mode) != 0)
+    {
+        hashtable_remove_entry(path);
+        discard_inode(ino);
+        return -EIO;
+    }
+
+    // after path exists, so lookup that missed it before cannot cache it as missing
+    negative_cache_invalidate(path);
+
+    return ino;
+}
+
+/* deletes inode with its blocks from server and caches */
+
+static void remove_inode(int inode_value, inode_t *inode)
+{
+    int num_blocks = inode->attrs.st_blocks;
+
+    if (S_ISDIR(inode->attrs.st_mode)) // record in block 0 and its buckets
+    {
+        char *dentries = get_dentries(inode_value);
+        int split = -1;
+        int buckets = dentry_buckets(dentries, &split);
+
+        char **keys = (char **)malloc(buckets * sizeof(char *));
+
+        for (int i = 0; i < buckets; i++)
+        {
+            keys[i] = bucket_key(inode_value, split, i);
+        }
+
+        if (buckets > 0)
+        {
+            memcached_delete_multi(keys, buckets);
+        }
+
+        for (int i = 0; i < buckets; i++)
         {
-            size_t write_size = (i == block_info->num_blocks - 1) ? block_info->bytes_in_end_block : FILE_BLOCK_SIZE;
-            memcpy(data + write_offset, buf + written_bytes, write_size);
-            written_bytes += write_size;
+            free(keys[i]);
         }
 
-        memcached_set(block_key, data, FILE_BLOCK_SIZE);
+        free(keys);
+        free(dentries);
+
+        num_blocks = 1;
+    }
 
+    for (int i = 0; i < num_blocks; i++)
+    {
+        char *block_key = block_key_to_string(inode_value, i);
+        memcached_delete(block_key);
         free(block_key);
-        free(data);
+
+        block_cache_invalidate(inode_value, i);
+    }
+
+    char *inode_key = int_to_string(inode_value);
+    memcached_delete(inode_key);
+    free(inode_key);
+
+    inode_cache_invalidate(inode_value);
+}
+
+/* removes path from its directory, then its inode. returns 0 or -errno if entry could not be removed (inode
+   is kept then) */
+
+static int delete_inode(char *path)
+{
+    int inode_value = lookup_path(path);
+    int result = remove_link_from_parent_dir(path);
+
+    if (result != 0)
+    {
+        return result;
+    }
+
+    hashtable_remove_entry(path);
+
+    // remove from memcached server this inode with its blocks
+    inode_t inode;
+    char *record = NULL;
+
+    if (get_inode(inode_value, &inode, &record) != 0)
+    {
+        return 0;
+    }
+
+    if (S_ISREG(inode.attrs.st_mode) && inode.attrs.st_nlink > 1) // hard link
+    {
+        // do not delete blocks
+        inode.attrs.st_nlink -= 1;
+        put_inode(inode_value, &inode);
+    }
+    else
+    {
+        remove_inode(inode_value, &inode);
+    }
+
+    free(record);
+
+    return 0;
+}
+
+/* low-level kernel counts lookups of every inode it knows (entries in lookup, create, mkdir, symlink and link
+   replies) and gives them back with forget. nodes keep these counts, inode that loses its last link while kernel
+   still knows it (open file) is deleted on last forget. kernel knows every directory above inode it knows, so
+   parents of nodes lead up to root. path interface never counts lookups */
+
+typedef struct node
+{
+    int inode_value;
+    uint64_t nlookup;
+    int unlinked; /* last link was removed, inode is deleted when nlookup drops to 0 */
+    int parent;   /* directory entry of inode was last returned from */
+    UT_hash_handle hh;
+} node;
+
+static node *nodes = NULL;
+static pthread_mutex_t nodes_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void node_lookup(int inode_value, int parent)
+{
+    pthread_mutex_lock(&nodes_lock);
+
+    node *n = NULL;
+    HASH_FIND_INT(nodes, &inode_value, n);
+
+    if (n == NULL)
+    {
+        n = (node *)calloc(1, sizeof(node));
+        n->inode_value = inode_value;
+        HASH_ADD_INT(nodes, inode_value, n);
+    }
+
+    n->nlookup += 1;
+    n->parent = parent;
+
+    pthread_mutex_unlock(&nodes_lock);
+}
+
+/* entry of inode was moved to directory parent */
+
+static void node_move(int inode_value, int parent)
+{
+    pthread_mutex_lock(&nodes_lock);
+
+    node *n = NULL;
+    HASH_FIND_INT(nodes, &inode_value, n);
+
+    if (n != NULL)
+    {
+        n->parent = parent;
+    }
+
+    pthread_mutex_unlock(&nodes_lock);
+}
+
+/* returns 1 if directory dir_value is inode_value or is below it, as far as parents of nodes are known (only
+   dir_value itself with path interface) */
+
+static int node_within(int dir_value, int inode_value)
+{
+    pthread_mutex_lock(&nodes_lock);
+
+    int within = 0;
+    unsigned int steps = HASH_COUNT(nodes);
+    node *n = NULL;
+
+    while (1)
+    {
+        if (dir_value == inode_value)
+        {
+            within = 1;
+            break;
+        }
+
+        HASH_FIND_INT(nodes, &dir_value, n);
+
+        if (n == NULL || steps == 0) // root or directory kernel does not know
+        {
+            break;
+        }
+
+        dir_value = n->parent;
+        steps -= 1;
+    }
+
+    pthread_mutex_unlock(&nodes_lock);
+
+    return within;
+}
+
+/* returns 1 if inode has no links and kernel does not know it anymore, so it can be deleted */
+
+static int node_forget(int inode_value, uint64_t nlookup)
+{
+    pthread_mutex_lock(&nodes_lock);
+
+    node *n = NULL;
+    HASH_FIND_INT(nodes, &inode_value, n);
+
+    int unlinked = 0;
+
+    if (n != NULL)
+    {
+        n->nlookup -= (nlookup < n->nlookup) ? nlookup : n->nlookup;
+
+        if (n->nlookup == 0)
+        {
+            unlinked = n->unlinked;
+
+            HASH_DEL(nodes, n);
+            free(n);
+        }
+    }
+
+    pthread_mutex_unlock(&nodes_lock);
+
+    return unlinked;
+}
+
+/* inode lost its last link. returns 1 if kernel still knows it (deleted on last forget), 0 if it can be deleted */
+
+static int node_unlink(int inode_value)
+{
+    pthread_mutex_lock(&nodes_lock);
+
+    node *n = NULL;
+    HASH_FIND_INT(nodes, &inode_value, n);
+
+    int known = (n != NULL && n->nlookup > 0);
+
+    if (known)
+    {
+        n->unlinked = 1;
+    }
+
+    pthread_mutex_unlock(&nodes_lock);
+
+    return known;
+}
+
+/* removes one link of inode. inode left without links is deleted, unless kernel still knows it */
+
+static void unlink_inode(int inode_value)
+{
+    inode_t inode;
+    char *record = NULL;
+
+    if (get_inode(inode_value, &inode, &record) != 0)
+    {
+        return;
+    }
+
+    if (S_ISREG(inode.attrs.st_mode) && inode.attrs.st_nlink > 1) // hard link
+    {
+        inode.attrs.st_nlink -= 1;
+        put_inode(inode_value, &inode);
+    }
+    else if (node_unlink(inode_value))
+    {
+        inode.attrs.st_nlink = 0;
+        put_inode(inode_value, &inode);
+    }
+    else
+    {
+        remove_inode(inode_value, &inode);
+    }
+
+    free(record);
+}
+
+static int stop_walk(void *ctx, dentry *entry)
+{
+    return 1;
+}
+
+static int dir_is_empty(int dir_value)
+{
+    return !walk_dentries(dir_value, 0, stop_walk, NULL);
+}
+
+/* moves entry old_name of old_dir to new_name of new_dir. only two directory records change, whatever is in
+   moved directory, and entry is added to new directory before it is removed from old one, so it is never
+   missing. entry that was at new_name loses a link. RENAME_NOREPLACE fails if new_name exists, RENAME_EXCHANGE
+   swaps two existing entries. directory can not be moved into itself or below itself (checked with parents of
+   nodes here, path interface checks paths). returns 0 or -errno */
+
+static int rename_dentry(int old_dir, char *old_name, int new_dir, char *new_name, unsigned int flags)
+{
+    if ((flags & ~(RENAME_NOREPLACE | RENAME_EXCHANGE)) || flags == (RENAME_NOREPLACE | RENAME_EXCHANGE) ||
+        !valid_name(new_name))
+    {
+        return -EINVAL;
+    }
+
+    int old_type = DT_UNKNOWN;
+    int new_type = DT_UNKNOWN;
+
+    int inode_value = find_dentry(old_dir, old_name, &old_type);
+
+    if (inode_value == -1)
+    {
+        return -ENOENT;
+    }
+
+    if (old_type == DT_DIR && node_within(new_dir, inode_value))
+    {
+        return -EINVAL;
+    }
+
+    int replaced = find_dentry(new_dir, new_name, &new_type);
+
+    if (replaced != -1 && (flags & RENAME_NOREPLACE))
+    {
+        return -EEXIST;
+    }
+
+    if (flags & RENAME_EXCHANGE)
+    {
+        if (replaced == -1)
+        {
+            return -ENOENT;
+        }
+
+        if (new_type == DT_DIR && node_within(old_dir, replaced))
+        {
+            return -EINVAL;
+        }
+
+        if (update_dentries(new_dir, new_name, inode_value, old_type) != 0)
+        {
+            return -EIO;
+        }
+
+        if (update_dentries(old_dir, old_name, replaced, new_type) != 0)
+        {
+            update_dentries(new_dir, new_name, replaced, new_type); // both names keep their entries
+            return -EIO;
+        }
+
+        node_move(inode_value, new_dir);
+        node_move(replaced, old_dir);
+
+        return 0;
+    }
+
+    if (replaced == inode_value) // both names are links of same inode
+    {
+        return 0;
+    }
+
+    if (replaced != -1)
+    {
+        if (old_type != DT_DIR && new_type == DT_DIR)
+        {
+            return -EISDIR;
+        }
+
+        if (old_type == DT_DIR && new_type != DT_DIR)
+        {
+            return -ENOTDIR;
+        }
+
+        if (new_type == DT_DIR && !dir_is_empty(replaced))
+        {
+            return -ENOTEMPTY;
+        }
+    }
+
+    if (update_dentries(new_dir, new_name, inode_value, old_type) != 0)
+    {
+        return -EIO;
+    }
+
+    if (update_dentries(old_dir, old_name, -1, DT_UNKNOWN) != 0)
+    {
+        update_dentries(new_dir, new_name, replaced, new_type); // entry replaced at new_name comes back
+        return -EIO;
+    }
+
+    node_move(inode_value, new_dir);
+
+    if (replaced != -1)
+    {
+        unlink_inode(replaced);
+    }
+
+    return 0;
+}
+
+/* write-back: every open file (fi->fh) keeps blocks written through it until they are flushed -
+   on flush/fsync/release, when they take more than writeback_kb or when they are older than
+   WRITEBACK_INTERVAL_MS. written bytes of block are marked in its mask, clean bytes are filled
+   from stored block only when block is flushed */
+
+typedef struct dirty_block
+{
+    int block_num;
+    char *data;
+    unsigned char *mask; /* bit set for every written byte */
+    int dirty_bytes;
+    UT_hash_handle hh;
+} dirty_block;
+
+typedef struct open_file
+{
+    int inode_value;
+    int block_size;
+    pthread_mutex_t lock;
+    dirty_block *blocks;
+    int num_blocks;
+    off_t size; /* end of furthest write not yet flushed */
+    struct timespec dirty_since;
+    off_t next_read; /* offset right after last read, next read starting there is sequential */
+    int readahead_window; /* blocks prefetched ahead of sequential reads, 0 for random access */
+    int readahead_until; /* first block not prefetched yet */
+    inode_attrs attrs; /* inode as it was opened or last flushed through this handle, valid if attrs_valid */
+    int attrs_valid;
+    struct open_file *prev; /* list of all open files, walked by flusher thread */
+    struct open_file *next;
+} open_file;
+
+static open_file *open_files = NULL;
+static pthread_mutex_t open_files_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* copies cached block into new block_size buffer, returns size of cached block, -1 if block is not cached */
+
+static ssize_t cached_block_copy(int inode_value, int block_num, int block_size, char **block)
+{
+    char *data = (char *)malloc(block_size);
+    ssize_t copied = block_cache_get(inode_value, block_num, data, 0, block_size);
+
+    if (copied == -1)
+    {
+        free(data);
+        return -1;
+    }
+
+    *block = data;
+
+    return copied;
+}
+
+static long elapsed_ms(struct timespec *since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+static void init_open_file(open_file *file, int inode_value, int block_size)
+{
+    memset(file, 0, sizeof(open_file));
+    file->inode_value = inode_value;
+    file->block_size = block_size;
+    pthread_mutex_init(&file->lock, NULL);
+}
+
+/* attrs (NULL if they are not known) are kept in handle, so reads through it do not read inode */
+
+static open_file *open_file_handle(int inode_value, int block_size, inode_attrs *attrs)
+{
+    open_file *file = (open_file *)malloc(sizeof(open_file));
+    init_open_file(file, inode_value, block_size);
+
+    if (attrs != NULL)
+    {
+        file->attrs = *attrs;
+        file->attrs_valid = 1;
+    }
+
+    pthread_mutex_lock(&open_files_lock);
+
+    file->next = open_files;
+
+    if (open_files != NULL)
+    {
+        open_files->prev = file;
+    }
+
+    open_files = file;
+
+    pthread_mutex_unlock(&open_files_lock);
+
+    return file;
+}
+
+static void discard_dirty_blocks(open_file *file)
+{
+    dirty_block *block, *tmp;
+
+    HASH_ITER(hh, file->blocks, block, tmp)
+    {
+        HASH_DEL(file->blocks, block);
+        free(block->data);
+        free(block->mask);
+        free(block);
+    }
+
+    file->num_blocks = 0;
+    file->size = 0;
+}
+
+static dirty_block *get_dirty_block(open_file *file, int block_num)
+{
+    dirty_block *block = NULL;
+    HASH_FIND_INT(file->blocks, &block_num, block);
+
+    if (block == NULL)
+    {
+        block = (dirty_block *)calloc(1, sizeof(dirty_block));
+        block->block_num = block_num;
+        block->data = (char *)calloc(1, file->block_size + 1);
+        block->mask = (unsigned char *)calloc(1, (file->block_size + 7) / 8);
+        HASH_ADD_INT(file->blocks, block_num, block);
+        file->num_blocks += 1;
+    }
+
+    return block;
+}
+
+static void buffer_write(open_file *file, const char *buf, size_t size, off_t offset)
+{
+    if (file->blocks == NULL)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &file->dirty_since);
+    }
+
+    size_t written_bytes = 0;
+
+    while (written_bytes < size)
+    {
+        off_t position = offset + written_bytes;
+        int block_num = position / file->block_size;
+        size_t write_offset = position % file->block_size;
+        size_t write_size = file->block_size - write_offset;
+
+        if (write_size > size - written_bytes)
+        {
+            write_size = size - written_bytes;
+        }
+
+        dirty_block *block = get_dirty_block(file, block_num);
+
+        memcpy(block->data + write_offset, buf + written_bytes, write_size);
+
+        for (size_t i = write_offset; i < write_offset + write_size; i++)
+        {
+            if (!(block->mask[i / 8] & (1 << (i % 8))))
+            {
+                block->mask[i / 8] |= 1 << (i % 8);
+                block->dirty_bytes += 1;
+            }
+        }
+
+        written_bytes += write_size;
+    }
+
+    if (offset + size > file->size)
+    {
+        file->size = offset + size;
+    }
+}
+
+/* fills bytes of block that were not written with stored data (stored_size bytes, stored block can be shorter
+   than block_size, bytes past its end are zero), after that whole block is valid */
+
+static void merge_stored_block(dirty_block *block, char *stored, size_t stored_size, int block_size)
+{
+    for (int i = 0; i < block_size; i++)
+    {
+        if (!(block->mask[i / 8] & (1 << (i % 8))))
+        {
+            block->data[i] = ((size_t)i < stored_size) ? stored[i] : 0;
+        }
+    }
+
+    memset(block->mask, 0xFF, (block_size + 7) / 8);
+    block->dirty_bytes = block_size;
+}
+
+/* stores content of small file in its inode, together with new size */
+
+static int store_inline(open_file *file, inode_t *inode, size_t new_size)
+{
+    char *new_content = (char *)calloc(1, new_size + 1);
+    memcpy(new_content, inode->content, (inode->attrs.content_size < new_size) ? inode->attrs.content_size : new_size);
+
+    dirty_block *block, *tmp;
+
+    HASH_ITER(hh, file->blocks, block, tmp)
+    {
+        size_t block_start = (size_t)block->block_num * file->block_size;
+
+        for (int i = 0; i < file->block_size && block_start + i < new_size; i++)
+        {
+            if (block->mask[i / 8] & (1 << (i % 8)))
+            {
+                new_content[block_start + i] = block->data[i];
+            }
+        }
+    }
+
+    inode->content = new_content;
+    inode->attrs.content_size = new_size;
+    inode->attrs.st_size = new_size;
+
+    int set = put_inode(file->inode_value, inode);
+
+    free(new_content);
+
+    if (set != 1)
+    {
+        return -EIO;
+    }
+
+    file->attrs = inode->attrs;
+    file->attrs_valid = 1;
+
+    discard_dirty_blocks(file);
+
+    return 0;
+}
+
+/* file outgrew inline content, content becomes stored data of its first blocks */
+
+static void promote_inline(open_file *file, char *content, size_t content_size)
+{
+    for (size_t position = 0; position < content_size; position += file->block_size)
+    {
+        size_t size = (content_size - position < file->block_size) ? content_size - position : file->block_size;
+
+        merge_stored_block(get_dirty_block(file, position / file->block_size), content + position, size,
+                           file->block_size);
+    }
+}
+
+static int compare_block_num(dirty_block *a, dirty_block *b)
+{
+    return a->block_num - b->block_num;
+}
+
+/* sends all dirty blocks of file with one pipelined request, then updates inode. caller holds file->lock.
+   on failure blocks stay dirty */
+
+static int flush_open_file(open_file *file)
+{
+    if (file->blocks == NULL)
+    {
+        return 0;
+    }
+
+    inode_t inode;
+    char *record = NULL;
+
+    if (get_inode(file->inode_value, &inode, &record) != 0) // file was deleted
+    {
+        discard_dirty_blocks(file);
+        return 0;
+    }
+
+    unsigned long st_size = inode.attrs.st_size;
+    unsigned long st_blocks = inode.attrs.st_blocks;
+
+    if (inode.attrs.flags & INODE_INLINE)
+    {
+        size_t new_size = (file->size > st_size) ? file->size : st_size;
+
+        if (options.inline_size > 0 && new_size <= (size_t)options.inline_size)
+        {
+            int stored = store_inline(file, &inode, new_size);
+            free(record);
+
+            return stored;
+        }
+
+        promote_inline(file, inode.content, inode.attrs.content_size);
+
+        // inode loses inline content only after blocks are stored
+        inode.attrs.flags &= ~INODE_INLINE;
+        inode.attrs.content_size = 0;
+    }
+
+    HASH_SORT(file->blocks, compare_block_num);
+
+    int num_blocks = file->num_blocks;
+
+    char *block_keys[num_blocks];
+    char *blocks[num_blocks];
+    size_t block_sizes[num_blocks];
+    int block_nums[num_blocks];
+
+    char *fetch_keys[num_blocks];
+    dirty_block *fetch_blocks[num_blocks];
+    int num_fetch = 0;
+
+    dirty_block *block, *tmp;
+    int i = 0;
+
+    HASH_ITER(hh, file->blocks, block, tmp)
+    {
+        block_keys[i] = block_key_to_string(file->inode_value, block->block_num);
+        blocks[i] = block->data;
+        block_sizes[i] = file->block_size;
+        block_nums[i] = block->block_num;
+
+        // partially written block needs its stored data, unless it starts past end of file
+        if (block->dirty_bytes < file->block_size && (unsigned long)block->block_num * file->block_size < st_size)
+        {
+            char *stored = NULL;
+            ssize_t stored_size = cached_block_copy(file->inode_value, block->block_num, file->block_size, &stored);
+
+            if (stored_size != -1)
+            {
+                merge_stored_block(block, stored, stored_size, file->block_size);
+                free(stored);
+            }
+            else
+            {
+                fetch_keys[num_fetch] = block_keys[i];
+                fetch_blocks[num_fetch] = block;
+                num_fetch += 1;
+            }
+        }
+
+        if (block->block_num + 1 > st_blocks)
+        {
+            st_blocks = block->block_num + 1;
+        }
+
+        i += 1;
+    }
+
+    if (num_fetch > 0)
+    {
+        char *fetched[num_fetch];
+        size_t fetched_sizes[num_fetch];
+
+        // missing block is hole, but failed fetch is not: merged zeros would overwrite stored data
+        if (memcached_get_multi_sized(fetch_keys, num_fetch, fetched, fetched_sizes) == -1)
+        {
+            for (i = 0; i < num_blocks; i++)
+            {
+                free(block_keys[i]);
+            }
+
+            free(record);
+            return -EIO;
+        }
+
+        for (int j = 0; j < num_fetch; j++)
+        {
+            if (fetched[j] != NULL)
+            {
+                merge_stored_block(fetch_blocks[j], fetched[j], fetched_sizes[j], file->block_size);
+                free(fetched[j]);
+            }
+        }
+    }
+
+    // all blocks are sent pipelined, with one round trip at the end
+    int failed = memcached_set_multi(block_keys, blocks, block_sizes, num_blocks);
+
+    for (i = 0; i < num_blocks; i++)
+    {
+        // cache is written through, blocks that may not be stored are dropped from it
+        if (failed == 0)
+        {
+            block_cache_put(file->inode_value, block_nums[i], blocks[i], block_sizes[i]);
+        }
+        else
+        {
+            block_cache_invalidate(file->inode_value, block_nums[i]);
+        }
+
+        free(block_keys[i]);
+    }
+
+    if (failed != 0)
+    {
+        free(record);
+        return -EIO;
+    }
+
+    inode.attrs.st_blocks = st_blocks;
+
+    if (file->size > st_size)
+    {
+        inode.attrs.st_size = file->size;
+    }
+
+    int set = put_inode(file->inode_value, &inode);
+
+    free(record);
+
+    if (set != 1) // blocks stay dirty, next flush stores inode again
+    {
+        return -EIO;
+    }
+
+    file->attrs = inode.attrs;
+    file->attrs_valid = 1;
+
+    discard_dirty_blocks(file);
+
+    return 0;
+}
+
+static int flush_file_info(struct fuse_file_info *fi)
+{
+    open_file *file = (fi != NULL) ? (open_file *)(uintptr_t)fi->fh : NULL;
+
+    if (file == NULL)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&file->lock);
+    int flushed = flush_open_file(file);
+    pthread_mutex_unlock(&file->lock);
+
+    return flushed;
+}
+
+/* flushes blocks dirty for longer than WRITEBACK_INTERVAL_MS, or all dirty blocks if all is set */
+
+static void flush_open_files(int all)
+{
+    pthread_mutex_lock(&open_files_lock);
+
+    for (open_file *file = open_files; file != NULL; file = file->next)
+    {
+        pthread_mutex_lock(&file->lock);
+
+        if (file->blocks != NULL && (all || elapsed_ms(&file->dirty_since) >= WRITEBACK_INTERVAL_MS))
+        {
+            flush_open_file(file);
+        }
+
+        pthread_mutex_unlock(&file->lock);
+    }
+
+    pthread_mutex_unlock(&open_files_lock);
+}
+
+static void close_open_file(open_file *file)
+{
+    pthread_mutex_lock(&open_files_lock);
+
+    if (file->prev != NULL)
+        file->prev->next = file->next;
+    else
+        open_files = file->next;
+
+    if (file->next != NULL)
+        file->next->prev = file->prev;
+
+    pthread_mutex_unlock(&open_files_lock);
+
+    discard_dirty_blocks(file);
+    pthread_mutex_destroy(&file->lock);
+    free(file);
+}
+
+static void *flusher_thread(void *arg)
+{
+    while (1)
+    {
+        usleep(WRITEBACK_INTERVAL_MS * 1000 / 2);
+        flush_open_files(0);
+    }
+
+    return NULL;
+}
+
+/* read-ahead: open file remembers where its last read ended. read starting there is sequential and
+   grows prefetch window (doubled up to readahead_kb), any other read collapses it. blocks of window
+   are fetched into block cache by READAHEAD_THREADS threads, so next reads find them there */
+
+typedef struct prefetch_job
+{
+    int inode_value;
+    int block_size;
+    int start_block;
+    int num_blocks;
+    struct prefetch_job *next;
+} prefetch_job;
+
+static prefetch_job *prefetch_head = NULL;
+static prefetch_job *prefetch_tail = NULL;
+static pthread_mutex_t prefetch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t prefetch_cond = PTHREAD_COND_INITIALIZER;
+
+static void queue_prefetch(int inode_value, int block_size, int start_block, int num_blocks)
+{
+    prefetch_job *job = (prefetch_job *)malloc(sizeof(prefetch_job));
+    job->inode_value = inode_value;
+    job->block_size = block_size;
+    job->start_block = start_block;
+    job->num_blocks = num_blocks;
+    job->next = NULL;
+
+    pthread_mutex_lock(&prefetch_lock);
+
+    if (prefetch_tail != NULL)
+        prefetch_tail->next = job;
+    else
+        prefetch_head = job;
+
+    prefetch_tail = job;
+
+    pthread_cond_signal(&prefetch_cond);
+    pthread_mutex_unlock(&prefetch_lock);
+}
+
+static void prefetch_blocks(prefetch_job *job)
+{
+    char *block_keys[job->num_blocks];
+    value_range ranges[job->num_blocks];
+    char *data = (char *)malloc((size_t)job->num_blocks * job->block_size);
+
+    for (int i = 0; i < job->num_blocks; i++)
+    {
+        block_keys[i] = block_key_to_string(job->inode_value, job->start_block + i);
+
+        ranges[i].dest = data + (size_t)i * job->block_size;
+        ranges[i].offset = 0;
+        ranges[i].size = job->block_size;
+    }
+
+    int found = memcached_get_ranges(block_keys, job->num_blocks, ranges);
+
+    for (int i = 0; i < job->num_blocks; i++)
+    {
+        if (found != -1)
+        {
+            ssize_t read = (ranges[i].read == -1) ? 0 : ranges[i].read;
+            block_cache_add(job->inode_value, job->start_block + i, ranges[i].dest, read);
+        }
+
+        free(block_keys[i]);
+    }
+
+    free(data);
+}
+
+static void *prefetch_thread(void *arg)
+{
+    while (1)
+    {
+        pthread_mutex_lock(&prefetch_lock);
+
+        while (prefetch_head == NULL)
+        {
+            pthread_cond_wait(&prefetch_cond, &prefetch_lock);
+        }
+
+        prefetch_job *job = prefetch_head;
+        prefetch_head = job->next;
+
+        if (prefetch_head == NULL)
+        {
+            prefetch_tail = NULL;
+        }
+
+        pthread_mutex_unlock(&prefetch_lock);
+
+        prefetch_blocks(job);
+        free(job);
+    }
+
+    return NULL;
+}
+
+/* called after read of [offset, offset + size) through file, st_size is size of file */
+
+static void read_ahead(open_file *file, off_t offset, size_t size, unsigned long st_size)
+{
+    if (options.readahead_kb <= 0 || options.block_cache_mb <= 0)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&file->lock);
+
+    int block_size = file->block_size;
+    int max_window = (options.readahead_kb * 1024 + block_size - 1) / block_size;
+
+    int end_block = (offset + size + block_size - 1) / block_size;
+    int last_block = (st_size + block_size - 1) / block_size;
+
+    if (offset == file->next_read) // reading from start of file counts as sequential too
+    {
+        int read_blocks = (size + block_size - 1) / block_size;
+
+        file->readahead_window = (file->readahead_window == 0) ? read_blocks : file->readahead_window * 2;
+
+        if (file->readahead_window > max_window)
+        {
+            file->readahead_window = max_window;
+        }
+    }
+    else // random access
+    {
+        file->readahead_window = 0;
+        file->readahead_until = 0;
+    }
+
+    file->next_read = offset + size;
+
+    // window is refilled when half of it is read
+    int start = (file->readahead_until > end_block) ? file->readahead_until : end_block;
+    int until = end_block + file->readahead_window;
+
+    if (until > last_block)
+    {
+        until = last_block;
+    }
+
+    if (file->readahead_window > 0 && start - end_block < file->readahead_window / 2 && until > start)
+    {
+        queue_prefetch(file->inode_value, block_size, start, until - start);
+        file->readahead_until = until;
+    }
+
+    pthread_mutex_unlock(&file->lock);
+}
+
+/* connects to servers, starts background threads and loads (or creates) filesystem, shared by both interfaces */
+
+static void init_filesystem()
+{
+    int protocol = PROTOCOL_ASCII;
+
+    if (options.protocol != NULL && strcmp(options.protocol, "meta") == 0)
+    {
+        protocol = PROTOCOL_META;
+    }
+
+    int engine = ENGINE_URING;
+
+    if (options.engine != NULL && strcmp(options.engine, "epoll") == 0)
+    {
+        engine = ENGINE_EPOLL;
+    }
+
+    memcached_connect(options.servers, options.num_servers, options.connections, protocol, engine);
+
+    if (options.udp)
+    {
+        memcached_enable_udp();
+    }
+
+    if (options.block_size <= 0 || options.block_size > MAX_FILE_BLOCK_SIZE)
+    {
+        options.block_size = (options.block_size <= 0) ? FILE_BLOCK_SIZE : MAX_FILE_BLOCK_SIZE;
+    }
+
+    block_cache_init((size_t)options.block_cache_mb * 1024 * 1024);
+    inode_cache_init(options.attr_timeout);
+    negative_cache_init(options.negative_timeout);
+
+    if (options.writeback_kb > 0)
+    {
+        pthread_t flusher;
+        pthread_create(&flusher, NULL, flusher_thread, NULL);
+        pthread_detach(flusher);
+    }
+
+    for (int i = 0; options.readahead_kb > 0 && options.block_cache_mb > 0 && i < READAHEAD_THREADS; i++)
+    {
+        pthread_t prefetcher;
+        pthread_create(&prefetcher, NULL, prefetch_thread, NULL);
+        pthread_detach(prefetcher);
+    }
+
+    hashtable_init();
+
+    inode_t root;
+    char *record = NULL;
+
+    // server is formatted only when it answers that root is missing, not when it could not be read
+    char *keys[2] = {"inode_table", int_to_string(ROOT_INODE)};
+    char *values[2] = {NULL, NULL};
+    size_t sizes[2] = {0, 0};
+
+    int found = memcached_get_multi_sized(keys, 2, values, sizes);
+
+    free(keys[1]);
+
+    if (found == -1)
+    {
+        printf("could not read filesystem from server\n");
+        exit(EIO);
+    }
+
+    char *inode_table = values[0];
+
+    if (inode_table != NULL) // filesystem of older version
+    {
+        free(values[1]);
+
+        hashtable_string_to_table(inode_table);
+        upgrade_inode_table();
+
+        free(inode_table);
+    }
+    else if (values[1] == NULL) // no filesystem stored in memcached
+    {
+        memcached_flush_all();
+        memcached_set("inode_value", "1", 1); // ids are leased after root
+
+        if (init_inode(ROOT_INODE, S_IFDIR | 0755, 2, getuid(), getgid(), 0, NULL) != 1)
+        {
+            printf("could not store root inode\n");
+            exit(EIO);
+        }
+
+        hashtable_add_entry("/", ROOT_INODE);
+    }
+    else if (decode_inode(ROOT_INODE, values[1], sizes[1], &root, &record) != 0)
+    {
+        printf("root inode can not be decoded\n");
+        exit(EIO);
+    }
+    else if (options.lazy || options.lowlevel) // paths are resolved when they are used (or never, by low-level)
+    {
+        free(record);
+    }
+    else
+    {
+        free(record);
+
+        hashtable_add_entry("/", ROOT_INODE);
+        load_directory("/", ROOT_INODE);
+    }
+
+    // path index is only a cache of resolved paths, also on new or upgraded filesystem
+    if (options.lazy || options.lowlevel)
+    {
+        hashtable_set_limit(options.path_cache > 0 ? options.path_cache : DEFAULT_PATH_CACHE);
+    }
+}
+
+static void *memcached_init(struct fuse_conn_info *conn,
+                            struct fuse_config *cfg)
+{
+    printf("init \n");
+
+    init_filesystem();
+
+    cfg->attr_timeout = options.attr_timeout;
+    cfg->entry_timeout = options.entry_timeout;
+    cfg->negative_timeout = options.negative_timeout;
+
+    return NULL;
+}
+
+static int memcached_getattr(const char *path, struct stat *stbuf,
+                             struct fuse_file_info *fi)
+{
+    printf("get attr %s\n", path);
+
+    int flushed = flush_file_info(fi); // size and blocks written through this handle
+
+    if (flushed != 0)
+    {
+        return flushed;
+    }
+
+    if (negative_cache_contains(path))
+    {
+        return -ENOENT;
+    }
+
+    unsigned long generation = negative_cache_generation();
+    int inode_value = lookup_path(path);
+
+    if (inode_value == -1)
+    {
+        // this path does not exist
+        negative_cache_add(path, generation);
+        return -ENOENT;
+    }
+
+    inode_t inode;
+    char *record = NULL;
+
+    if (get_inode(inode_value, &inode, &record) != 0)
+    {
+        return -ENOENT;
+    }
+
+    fill_stat(&inode, stbuf);
+
+    free(record);
+
+    return 0;
+}
+
+static int memcached_mkdir(const char *path, mode_t mode)
+{
+    printf("mkdir: %s\n", path);
+
+    if (!valid_name(path))
+    {
+        return -EINVAL;
+    }
+
+    int ino = create_inode((char *)path, S_IFDIR | mode, 2, getuid(), getgid(), 0, NULL);
+
+    return (ino < 0) ? ino : 0;
+}
+
+static int memcached_rmdir(const char *path)
+{
+    int inode_value = lookup_path(path);
+
+    if (!dir_is_empty(inode_value))
+    {
+        return -ENOTEMPTY;
+    }
+
+    return delete_inode((char *)path);
+}
+
+static int memcached_opendir(const char *path, struct fuse_file_info *fi)
+{
+    int inode_value = lookup_path(path);
+
+    if (inode_value == -1)
+    {
+        // this path does not exist
+        return -ENOENT;
+    }
+
+    return 0;
+}
+
+typedef struct readdir_buffer
+{
+    void *buf;
+    fuse_fill_dir_t filler;
+} readdir_buffer;
+
+static int fill_dentry(void *ctx, dentry *entry, struct stat *stbuf)
+{
+    readdir_buffer *readdir = (readdir_buffer *)ctx;
+
+    // non-zero when buffer is full
+    return readdir->filler(readdir->buf, entry->name, stbuf, entry->hash + 3, (stbuf != NULL) ? FUSE_FILL_DIR_PLUS : 0);
+}
+
+static int memcached_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t off, struct fuse_file_info *fi, enum fuse_readdir_flags flags)
+{
+    int inode_value = lookup_path(path);
+
+    if (inode_value == -1)
+    {
+        return -ENOENT;
+    }
+
+    if (off < 1 && filler(buf, ".", NULL, 1, 0) != 0)
+    {
+        return 0;
+    }
+
+    if (off < 2 && filler(buf, "..", NULL, 2, 0) != 0)
+    {
+        return 0;
+    }
+
+    readdir_buffer readdir = {buf, filler};
+
+    readdir_dentries(inode_value, off, (flags & FUSE_READDIR_PLUS) != 0, fill_dentry, &readdir);
+
+    return 0;
+}
+
+static int memcached_releasedir(const char *path, struct fuse_file_info *fi)
+{
+    return 0;
+}
+
+static int memcached_fsyncdir(const char *path, int datasync, struct fuse_file_info *fi)
+{
+    return 0;
+}
+
+static int memcached_unlink(const char *path)
+{
+    return delete_inode((char *)path);
+}
+
+static int memcached_create(const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    if (!valid_name(path))
+    {
+        return -EINVAL;
+    }
+
+    int ino = create_inode((char *)path, mode, 1, getuid(), getgid(), 0, NULL);
+
+    if (ino < 0)
+    {
+        return ino;
+    }
+
+    fi->fh = (uintptr_t)open_file_handle(ino, options.block_size, NULL);
+
+    return 0;
+}
+
+static int memcached_open(const char *path, struct fuse_file_info *fi)
+{
+    int inode_value = lookup_path(path);
+
+    if (inode_value == -1)
+    {
+        // this path does not exist
+        return -ENOENT;
+    }
+
+    inode_t inode;
+    char *record = NULL;
+
+    if (get_inode(inode_value, &inode, &record) != 0)
+    {
+        return -ENOENT;
+    }
+
+    fi->fh = (uintptr_t)open_file_handle(inode_value, inode_block_size(&inode), &inode.attrs);
+
+    free(record);
+
+    return 0;
+}
+
+/* reads file data into buf, returns number of bytes read or -errno. file is handle read through (NULL if
+   file was not opened), its sequential reads are followed by read-ahead */
+
+/* attributes kept in handle, if read ending at end can use them. files only grow, so they are good for reads
+   within size they have, and read past it (file may have grown) or of inline content reads inode */
+
+static int handle_attrs(open_file *file, off_t end, inode_attrs *attrs)
+{
+    if (file == NULL)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&file->lock);
+
+    int valid = file->attrs_valid && !(file->attrs.flags & INODE_INLINE) && (unsigned long)end <= file->attrs.st_size;
+
+    if (valid)
+    {
+        *attrs = file->attrs;
+    }
+
+    pthread_mutex_unlock(&file->lock);
+
+    return valid;
+}
+
+static int read_inode(int inode_value, char *buf, size_t size, off_t offset, open_file *file)
+{
+    inode_t inode;
+    char *record = NULL;
+
+    if (!handle_attrs(file, offset + size, &inode.attrs))
+    {
+        if (get_inode(inode_value, &inode, &record) != 0)
+        {
+            return -ENOENT;
+        }
+
+        if (file != NULL)
+        {
+            pthread_mutex_lock(&file->lock);
+            file->attrs = inode.attrs;
+            file->attrs_valid = 1;
+            pthread_mutex_unlock(&file->lock);
+        }
+    }
+
+    unsigned long st_size = inode.attrs.st_size;
+
+    if (st_size <= offset) // offset at or beyond end of file
+    {
+        free(record);
+        return 0;
+    }
+
+    if (offset + size > st_size)
+    {
+        size = st_size - offset;
+    }
+
+    if (inode.attrs.flags & INODE_INLINE) // small file, content is stored in inode
+    {
+        size_t content_size = inode.attrs.content_size;
+
+        size_t read = (content_size > offset) ? content_size - offset : 0;
+        read = (read > size) ? size : read;
+
+        memcpy(buf, inode.content + offset, read);
+        memset(buf + read, 0, size - read);
+
+        free(record);
+
+        return size;
+    }
+
+    int block_size = inode_block_size(&inode);
+
+    file_blocks_t *block_info = get_file_blocks_info(offset, size, block_size);
+
+    size_t already_read_bytes = 0;
+
+    // blocks found in cache are copied right away, rest are fetched with one request. whole blocks are
+    // fetched, so they can be cached - straight into buf if all of block is read, else into temporary block
+    char *block_keys[block_info->num_blocks];
+    value_range ranges[block_info->num_blocks];
+    char *dests[block_info->num_blocks];
+    size_t read_offsets[block_info->num_blocks];
+    size_t read_sizes[block_info->num_blocks];
+    int block_nums[block_info->num_blocks];
+    int num_fetch = 0;
+
+    for (int i = 0; i < block_info->num_blocks; i++)
+    {
+        int block_num = block_info->start_block + i;
+
+        size_t read_offset = (i == 0) ? block_info->offset_in_start_block : 0;
+        size_t read_size = 0;
+
+        if (i == 0 && block_info->num_blocks == 1)
+        {
+            read_size = size;
+        }
+        else if (i == 0 && block_info->num_blocks > 1)
+        {
+            read_size = block_size - read_offset;
+        }
+        else // i != 0
+        {
+            read_size = (i == block_info->num_blocks - 1) ? block_info->bytes_in_end_block : block_size;
+        }
+
+        char *dest = buf + already_read_bytes;
+        already_read_bytes += read_size;
+
+        ssize_t cached = block_cache_get(inode_value, block_num, dest, read_offset, read_size);
+
+        if (cached != -1)
+        {
+            if (cached < read_size) // hole, block was never written
+            {
+                memset(dest + cached, 0, read_size - cached);
+            }
+
+            continue;
+        }
+
+        block_keys[num_fetch] = block_key_to_string(inode_value, block_num);
+        block_nums[num_fetch] = block_num;
+        dests[num_fetch] = dest;
+        read_offsets[num_fetch] = read_offset;
+        read_sizes[num_fetch] = read_size;
+
+        ranges[num_fetch].dest = (read_size == block_size) ? dest : (char *)malloc(block_size);
+        ranges[num_fetch].offset = 0;
+        ranges[num_fetch].size = block_size;
+
+        num_fetch += 1;
+    }
+
+    int found = (num_fetch > 0) ? memcached_get_ranges(block_keys, num_fetch, ranges) : 0;
+
+    for (int i = 0; i < num_fetch; i++)
+    {
+        ssize_t read = (ranges[i].read == -1) ? 0 : ranges[i].read;
+
+        if (found != -1) // block written through while it was fetched is newer than fetched one
+        {
+            block_cache_add(inode_value, block_nums[i], ranges[i].dest, read);
+        }
+
+        if (ranges[i].dest != dests[i])
+        {
+            read = (read > read_offsets[i]) ? read - read_offsets[i] : 0;
+            read = (read > read_sizes[i]) ? read_sizes[i] : read;
+
+            memcpy(dests[i], ranges[i].dest + read_offsets[i], read);
+            free(ranges[i].dest);
+        }
+
+        if (read < read_sizes[i]) // hole, block was never written
+        {
+            memset(dests[i] + read, 0, read_sizes[i] - read);
+        }
+
+        free(block_keys[i]);
+    }
+
+    if (file != NULL && found != -1)
+    {
+        read_ahead(file, offset, size, st_size);
+    }
+
+    free(block_info);
+    free(record);
+
+    if (found == -1)
+    {
+        return -EIO;
+    }
+
+    return size;
+}
+
+/* buffers write in file (handle written through), file that was not opened (NULL) is written through.
+   returns size or -errno */
+
+static int write_inode(int inode_value, const char *buf, size_t size, off_t offset, open_file *file)
+{
+    open_file unopened;
+
+    if (file == NULL) // written without open, nothing is buffered
+    {
+        inode_t inode;
+        char *record = NULL;
+
+        if (get_inode(inode_value, &inode, &record) != 0)
+        {
+            return -ENOENT;
+        }
+
+        init_open_file(&unopened, inode_value, inode_block_size(&inode));
+        file = &unopened;
+
+        free(record);
+    }
+
+    pthread_mutex_lock(&file->lock);
+
+    buffer_write(file, buf, size, offset);
+
+    int result = size;
+
+    if (file == &unopened || (size_t)file->num_blocks * file->block_size >= (size_t)options.writeback_kb * 1024)
+    {
+        if (flush_open_file(file) != 0)
+        {
+            result = -EIO;
+        }
+    }
+
+    if (file == &unopened)
+    {
+        discard_dirty_blocks(file);
+    }
+
+    pthread_mutex_unlock(&file->lock);
+
+    return result;
+}
+
+static int memcached_read(const char *path, char *buf, size_t size, off_t offset,
+                          struct fuse_file_info *fi)
+{
+    // blocks buffered by this handle are stored first, so they are read back
+    if (flush_file_info(fi) != 0)
+    {
+        return -EIO;
+    }
+
+    open_file *file = (fi != NULL) ? (open_file *)(uintptr_t)fi->fh : NULL;
+
+    // opened file knows its inode, path is looked up only for file read without open
+    return read_inode((file != NULL) ? file->inode_value : lookup_path(path), buf, size, offset, file);
+}
+
+static int memcached_write(const char *path, const char *buf, size_t size, off_t offset,
+                           struct fuse_file_info *fi)
+{
+    open_file *file = (fi != NULL) ? (open_file *)(uintptr_t)fi->fh : NULL;
+
+    return write_inode((file != NULL) ? file->inode_value : lookup_path(path), buf, size, offset, file);
+}
+
+static int memcached_release(const char *path, struct fuse_file_info *fi)
+{
+    open_file *file = (open_file *)(uintptr_t)fi->fh;
+
+    if (file == NULL)
+    {
+        return 0;
+    }
+
+    int flushed = flush_file_info(fi);
+
+    close_open_file(file);
+    fi->fh = 0;
+
+    return flushed;
+}
+
+static int memcached_flush(const char *path, struct fuse_file_info *fi)
+{
+    return flush_file_info(fi);
+}
+
+static int memcached_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+    return flush_file_info(fi);
+}
+
+static int memcached_utimens(const char *path, const struct timespec tv[2], struct fuse_file_info *fi)
+{
+    return 0;
+}
+
+static int memcached_statfs(const char *path, struct statvfs *statv)
+{
+    return 0;
+}
+
+static void memcached_destroy(void *private_data)
+{
+    flush_open_files(1);
+
+    unsigned long hits, misses;
+    block_cache_stats(&hits, &misses);
+    printf("block cache: %lu hits, %lu misses \n", hits, misses);
+
+    inode_cache_stats(&hits, &misses);
+    printf("inode cache: %lu hits, %lu misses \n", hits, misses);
+
+    negative_cache_stats(&hits, &misses);
+    printf("negative lookup cache: %lu hits, %lu misses \n", hits, misses);
+
+    block_cache_free();
+    inode_cache_free();
+    negative_cache_free();
+    hashtable_free();
+    memcached_disconnect();
+    exit(0);
+}
+
+static int setxattr_inode(int inode_value, const char *name, const char *value, size_t size)
+{
+
+    inode_t inode;
+    char *record = NULL;
+
+    if (get_inode(inode_value, &inode, &record) != 0)
+    {
+        return -ENOENT;
+    }
+
+    // replaces value if attribute exists
+    size_t xattrs_size = 0;
+    char *xattrs = inode_replace_xattr(&inode, (char *)name, (char *)value, size, &xattrs_size);
+
+    inode.xattrs = xattrs;
+    inode.attrs.xattrs_size = xattrs_size;
+
+    put_inode(inode_value, &inode);
+
+    free(xattrs);
+    free(record);
+
+    return 0;
+}
+
+static int memcached_setxattr(const char *path, const char *name, const char *value, size_t size, int flags)
+{
+    return setxattr_inode(lookup_path(path), name, value, size);
+}
+
+static int getxattr_inode(int inode_value, const char *name, char *value, size_t size)
+{
+
+    inode_t inode;
+    char *record = NULL;
+
+    if (get_inode(inode_value, &inode, &record) != 0)
+    {
+        return -ENOENT;
+    }
+
+    uint32_t attr_value_size = 0;
+    char *attr_value = inode_get_xattr(&inode, (char *)name, &attr_value_size);
+
+    if (attr_value == NULL)
+    {
+        free(record);
+
+        return 0;
+    }
+    else
+    {
+        if (size == 0)
+        {
+            size = attr_value_size;
+        }
+        else
+        {
+            if (size > attr_value_size)
+                size = attr_value_size;
+            memcpy(value, attr_value, size);
+        }
+
+        free(record);
+
+        return size;
+    }
+}
+
+static int memcached_getxattr(const char *path, const char *name, char *value, size_t size)
+{
+    return getxattr_inode(lookup_path(path), name, value, size);
+}
+
+static int listxattr_inode(int inode_value, char *list, size_t size)
+{
+
+    inode_t inode;
+    char *record = NULL;
+
+    if (get_inode(inode_value, &inode, &record) != 0)
+    {
+        return -ENOENT;
+    }
+
+    size_t list_size = inode_list_xattrs(&inode, NULL);
+
+    if (size == 0)
+    {
+        size = list_size;
+    }
+    else
+    {
+        if (size > list_size)
+            size = list_size;
+        if (size > 0)
+        {
+            char names[list_size];
+            inode_list_xattrs(&inode, names);
+            memcpy(list, names, size);
+        }
+    }
+
+    free(record);
+
+    return size;
+}
+
+static int memcached_listxattr(const char *path, char *list, size_t size)
+{
+    return listxattr_inode(lookup_path(path), list, size);
+}
+
+static int removexattr_inode(int inode_value, const char *name)
+{
+
+    inode_t inode;
+    char *record = NULL;
+
+    if (get_inode(inode_value, &inode, &record) != 0)
+    {
+        return -ENOENT;
+    }
+
+    uint32_t attr_value_size = 0;
+
+    if (inode_get_xattr(&inode, (char *)name, &attr_value_size) != NULL)
+    {
+        size_t xattrs_size = 0;
+        char *xattrs = inode_replace_xattr(&inode, (char *)name, NULL, 0, &xattrs_size);
+
+        inode.xattrs = xattrs;
+        inode.attrs.xattrs_size = xattrs_size;
+
+        put_inode(inode_value, &inode);
+
+        free(xattrs);
+    }
+
+    free(record);
+
+    return 0;
+}
+
+static int memcached_removexattr(const char *path, const char *name)
+{
+    return removexattr_inode(lookup_path(path), name);
+}
+
+static int memcached_chmod(const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+    int inode_value = lookup_path(path);
+
+    inode_t inode;
+    char *record = NULL;
+
+    if (get_inode(inode_value, &inode, &record) != 0)
+    {
+        return -ENOENT;
+    }
+
+    inode.attrs.st_mode = mode;
+    put_inode(inode_value, &inode);
+
+    free(record);
+
+    return 0;
+}
+
+static int memcached_chown(const char *path, uid_t uid, gid_t gid, struct fuse_file_info *fi)
+{
+    if (uid == -1 && gid == -1)
+        return 0;
+
+    int inode_value = lookup_path(path);
+
+    inode_t inode;
+    char *record = NULL;
+
+    if (get_inode(inode_value, &inode, &record) != 0)
+    {
+        return -ENOENT;
+    }
+
+    if (uid != -1)
+    {
+        inode.attrs.st_uid = uid;
+    }
+
+    if (gid != -1)
+    {
+        inode.attrs.st_gid = gid;
+    }
+
+    put_inode(inode_value, &inode);
+
+    free(record);
+
+    return 0;
+}
+
+static int memcached_link(const char *oldpath, const char *newpath)
+{
+    if (!valid_name(newpath))
+    {
+        return -EINVAL;
+    }
+
+    int inode_value = lookup_path(oldpath);
+
+    inode_t inode;
+    char *record = NULL;
+
+    if (get_inode(inode_value, &inode, &record) != 0)
+    {
+        return -ENOENT;
+    }
+
+    inode.attrs.st_nlink += 1;
+    put_inode(inode_value, &inode);
+
+    mode_t mode = inode.attrs.st_mode;
+
+    if (add_link_to_parent_dir((char *)newpath, inode_value, mode) != 0)
+    {
+        inode.attrs.st_nlink -= 1;
+        put_inode(inode_value, &inode);
+        free(record);
+        return -EIO;
+    }
+
+    free(record);
+
+    hashtable_add_entry((char *)newpath, inode_value);
+
+    negative_cache_invalidate(newpath);
+
+    return 0;
+}
+
+/* returns 1 if path is below directory dir_path */
+
+static int path_below(const char *path, const char *dir_path)
+{
+    size_t dir_size = strlen(dir_path);
+
+    return strncmp(path, dir_path, dir_size) == 0 && path[dir_size] == '/';
+}
+
+static int memcached_rename(const char *oldpath, const char *newpath, unsigned int flags)
+{
+    char *old_parent = get_parent_directory(oldpath);
+    char *new_parent = get_parent_directory(newpath);
+    char *old_name = get_name_from_path(oldpath);
+    char *new_name = get_name_from_path(newpath);
+
+    int old_dir = lookup_path(old_parent);
+    int new_dir = lookup_path(new_parent);
+
+    int result = -ENOENT;
+
+    if (path_below(newpath, oldpath) || ((flags & RENAME_EXCHANGE) && path_below(oldpath, newpath)))
+    {
+        result = -EINVAL; // directory would be moved into itself
+    }
+    else if (old_dir != -1 && new_dir != -1)
+    {
+        result = rename_dentry(old_dir, old_name, new_dir, new_name, flags);
+    }
+
+    if (result == 0)
+    {
+        // paths under both names changed, path index entries move with them
+        negative_cache_invalidate_prefix(oldpath);
+        negative_cache_invalidate_prefix(newpath);
+
+        if (flags & RENAME_EXCHANGE)
+        {
+            hashtable_move_prefix((char *)oldpath, "\n"); // no path starts with newline
+            hashtable_move_prefix((char *)newpath, (char *)oldpath);
+            hashtable_move_prefix("\n", (char *)newpath);
+        }
+        else
+        {
+            hashtable_remove_entry((char *)newpath);
+            hashtable_move_prefix((char *)oldpath, (char *)newpath);
+        }
+    }
+
+    free(old_parent);
+    free(new_parent);
+    free(old_name);
+    free(new_name);
+
+    return result;
+}
+
+static int memcached_symlink(const char *linkname, const char *path)
+{
+    if (!valid_name(path))
+    {
+        return -EINVAL;
+    }
+
+    int ino = create_inode((char *)path, S_IFLNK | 0777, 1, getuid(), getgid(), strlen(linkname), (char *)linkname);
+
+    return (ino < 0) ? ino : 0;
+}
+
+static int readlink_inode(int inode_value, char *buf, size_t size)
+{
+
+    inode_t inode;
+    char *record = NULL;
+
+    if (get_inode(inode_value, &inode, &record) != 0)
+    {
+        return -ENOENT;
+    }
+
+    // target is not null-terminated in record
+    size_t content_size = (inode.attrs.content_size < size - 1) ? inode.attrs.content_size : size - 1;
+
+    memcpy(buf, inode.content, content_size);
+    buf[content_size] = '\0';
+
+    free(record);
+
+    return 0;
+}
+
+static int memcached_readlink(const char *path, char *buf, size_t size)
+{
+    return readlink_inode(lookup_path(path), buf, size);
+}
+
+/* low-level interface (-o lowlevel): kernel refers to inodes by number, fuse ino is inode id + 1 (FUSE_ROOT_ID
+   is root inode 0), so handlers go straight to inode and directory records and never hash paths */
+
+static fuse_ino_t to_fuse_ino(int inode_value)
+{
+    return (fuse_ino_t)inode_value + 1;
+}
+
+static int from_fuse_ino(fuse_ino_t ino)
+{
+    return (int)(ino - 1);
+}
+
+/* replies with entry of inode and counts lookup. fi is set for create, which also opens inode */
+
+static void reply_entry(fuse_req_t req, int parent, int inode_value, struct fuse_file_info *fi)
+{
+    inode_t inode;
+    char *record = NULL;
+
+    if (get_inode(inode_value, &inode, &record) != 0)
+    {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    struct fuse_entry_param e;
+    memset(&e, 0, sizeof(struct fuse_entry_param));
+
+    e.ino = to_fuse_ino(inode_value);
+    e.attr_timeout = options.attr_timeout;
+    e.entry_timeout = options.entry_timeout;
+    fill_stat(&inode, &e.attr);
+
+    int block_size = inode_block_size(&inode);
+
+    free(record);
+
+    node_lookup(inode_value, parent);
+
+    int replied;
+
+    if (fi != NULL)
+    {
+        fi->fh = (uintptr_t)open_file_handle(inode_value, block_size, &inode.attrs);
+        replied = fuse_reply_create(req, &e, fi);
+
+        if (replied != 0)
+        {
+            close_open_file((open_file *)(uintptr_t)fi->fh);
+        }
+    }
+    else
+    {
+        replied = fuse_reply_entry(req, &e);
+    }
+
+    if (replied != 0) // request was interrupted, kernel did not get entry
+    {
+        node_forget(inode_value, 1);
+    }
+}
+
+static void memcached_ll_init(void *userdata, struct fuse_conn_info *conn)
+{
+    printf("init low-level \n");
+
+    init_filesystem();
+}
+
+static void memcached_ll_destroy(void *userdata)
+{
+    memcached_destroy(userdata);
+}
+
+static void memcached_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    int inode_value = find_dentry(from_fuse_ino(parent), name, NULL);
+
+    if (inode_value == -1)
+    {
+        if (options.negative_timeout > 0) // entry with ino 0 is cached by kernel as missing name
+        {
+            struct fuse_entry_param e;
+            memset(&e, 0, sizeof(struct fuse_entry_param));
+            e.entry_timeout = options.negative_timeout;
+
+            fuse_reply_entry(req, &e);
+        }
+        else
+        {
+            fuse_reply_err(req, ENOENT);
+        }
+
+        return;
+    }
+
+    reply_entry(req, from_fuse_ino(parent), inode_value, NULL);
+}
+
+static void forget_inode(fuse_ino_t ino, uint64_t nlookup)
+{
+    int inode_value = from_fuse_ino(ino);
+
+    if (node_forget(inode_value, nlookup))
+    {
+        inode_t inode;
+        char *record = NULL;
+
+        if (get_inode(inode_value, &inode, &record) == 0)
+        {
+            remove_inode(inode_value, &inode);
+            free(record);
+        }
+    }
+}
+
+static void memcached_ll_forget(fuse_req_t req, fuse_ino_t ino, uint64_t nlookup)
+{
+    forget_inode(ino, nlookup);
+
+    fuse_reply_none(req);
+}
+
+static void memcached_ll_forget_multi(fuse_req_t req, size_t count, struct fuse_forget_data *forgets)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        forget_inode(forgets[i].ino, forgets[i].nlookup);
     }
-    char *inode_key = int_to_string(inode_value);
 
-    char *attribute_data = memcached_get(inode_key);
-    char *data_with_blocks = modify_attr(attribute_data, "st_blocks", block_info->num_blocks);
+    fuse_reply_none(req);
+}
+
+static void memcached_ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    int flushed = flush_file_info(fi); // size and blocks written through this handle
 
-    unsigned long st_size = get_attr_value(attribute_data, "st_size");
-    if (offset + size > st_size)
+    if (flushed != 0)
     {
-        char *data_with_size = modify_attr(data_with_blocks, "st_size", offset + size);
-        memcached_set(inode_key, data_with_size, strlen(data_with_size));
-        free(data_with_size);
+        fuse_reply_err(req, -flushed);
+        return;
     }
-    else
+
+    inode_t inode;
+    char *record = NULL;
+
+    if (get_inode(from_fuse_ino(ino), &inode, &record) != 0)
     {
-        memcached_set(inode_key, data_with_blocks, strlen(data_with_blocks));
+        fuse_reply_err(req, ENOENT);
+        return;
     }
 
-    free(attribute_data);
-    free(data_with_blocks);
+    struct stat stbuf;
+    memset(&stbuf, 0, sizeof(struct stat));
+    fill_stat(&inode, &stbuf);
 
-    free(block_info);
+    free(record);
 
-    return size;
+    fuse_reply_attr(req, &stbuf, options.attr_timeout);
 }
 
-static int memcached_release(const char *path, struct fuse_file_info *fi)
+/* mode, owner and group can be changed. times are not stored and size can not be set, same as in path
+   interface */
+
+static void memcached_ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set,
+                                 struct fuse_file_info *fi)
 {
-    return 0;
+    if (to_set & FUSE_SET_ATTR_SIZE)
+    {
+        fuse_reply_err(req, ENOSYS);
+        return;
+    }
+
+    int inode_value = from_fuse_ino(ino);
+
+    inode_t inode;
+    char *record = NULL;
+
+    if (get_inode(inode_value, &inode, &record) != 0)
+    {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    if (to_set & (FUSE_SET_ATTR_MODE | FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID))
+    {
+        if (to_set & FUSE_SET_ATTR_MODE)
+        {
+            inode.attrs.st_mode = (inode.attrs.st_mode & S_IFMT) | (attr->st_mode & 07777);
+        }
+
+        if (to_set & FUSE_SET_ATTR_UID)
+        {
+            inode.attrs.st_uid = attr->st_uid;
+        }
+
+        if (to_set & FUSE_SET_ATTR_GID)
+        {
+            inode.attrs.st_gid = attr->st_gid;
+        }
+
+        put_inode(inode_value, &inode);
+    }
+
+    struct stat stbuf;
+    memset(&stbuf, 0, sizeof(struct stat));
+    fill_stat(&inode, &stbuf);
+
+    free(record);
+
+    fuse_reply_attr(req, &stbuf, options.attr_timeout);
 }
 
-static int memcached_flush(const char *path, struct fuse_file_info *fi)
+static void memcached_ll_readlink(fuse_req_t req, fuse_ino_t ino)
 {
-    return 0;
+    char target[PATH_MAX];
+
+    if (readlink_inode(from_fuse_ino(ino), target, sizeof(target)) != 0)
+    {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    fuse_reply_readlink(req, target);
 }
 
-static int memcached_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+/* creates inode as name in parent and replies with its entry */
+
+static void make_entry(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, nlink_t nlink,
+                       const char *content, struct fuse_file_info *fi)
 {
-    return 0;
+    if (!valid_name(name))
+    {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+
+    if (find_dentry(from_fuse_ino(parent), name, NULL) != -1)
+    {
+        fuse_reply_err(req, EEXIST);
+        return;
+    }
+
+    off_t size = (content != NULL) ? strlen(content) : 0;
+
+    int inode_value = make_inode(from_fuse_ino(parent), (char *)name, mode, nlink, getuid(), getgid(), size,
+                                 (char *)content);
+
+    if (inode_value == -1)
+    {
+        fuse_reply_err(req, EIO);
+        return;
+    }
+
+    reply_entry(req, from_fuse_ino(parent), inode_value, fi);
 }
 
-static int memcached_utimens(const char *path, const struct timespec tv[2], struct fuse_file_info *fi)
+static void memcached_ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode)
 {
-    return 0;
+    make_entry(req, parent, name, S_IFDIR | mode, 2, NULL, NULL);
 }
 
-static int memcached_statfs(const char *path, struct statvfs *statv)
+static void memcached_ll_create(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode,
+                                struct fuse_file_info *fi)
 {
-    return 0;
+    make_entry(req, parent, name, mode, 1, NULL, fi);
 }
 
-static void memcached_destroy(void *private_data)
+static void memcached_ll_symlink(fuse_req_t req, const char *link, fuse_ino_t parent, const char *name)
 {
-    hashtable_free();
-    exit(0);
+    make_entry(req, parent, name, S_IFLNK | 0777, 1, link, NULL);
 }
 
-static int memcached_setxattr(const char *path, const char *name, const char *value, size_t size, int flags)
+static void memcached_ll_link(fuse_req_t req, fuse_ino_t ino, fuse_ino_t newparent, const char *newname)
 {
-    int inode_value = hashable_get_entry((char *)path);
-    char *inode_key = int_to_string(inode_value);
+    int inode_value = from_fuse_ino(ino);
 
-    char *attribute_data = memcached_get(inode_key);
+    if (!valid_name(newname))
+    {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
 
-    char *attr_value = get_attr_value_str(attribute_data, (char *)name);
+    if (find_dentry(from_fuse_ino(newparent), newname, NULL) != -1)
+    {
+        fuse_reply_err(req, EEXIST);
+        return;
+    }
 
-    char value_string[size + 1];
-    memcpy(value_string, value, size);
-    value_string[size] = '\0';
+    inode_t inode;
+    char *record = NULL;
 
-    if (attr_value == NULL) // key does not exist
+    if (get_inode(inode_value, &inode, &record) != 0)
     {
-        char *new_attribute_data = add_attr(attribute_data, (char *)name, value_string);
-        memcached_set(inode_key, new_attribute_data, strlen(new_attribute_data));
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    inode.attrs.st_nlink += 1;
+    put_inode(inode_value, &inode);
 
-        free(new_attribute_data);
+    mode_t mode = inode.attrs.st_mode;
+
+    if (update_dentries(from_fuse_ino(newparent), (char *)newname, inode_value, IFTODT(mode)) != 0)
+    {
+        inode.attrs.st_nlink -= 1;
+        put_inode(inode_value, &inode);
+        free(record);
+        fuse_reply_err(req, EIO);
+        return;
     }
-    else // replace
+
+    free(record);
+
+    reply_entry(req, from_fuse_ino(newparent), inode_value, NULL);
+}
+
+static void memcached_ll_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    int inode_value = find_dentry(from_fuse_ino(parent), name, NULL);
+
+    if (inode_value == -1)
     {
-        char *new_attribute_data = modify_attr_str(attribute_data, (char *)name, value_string);
-        memcached_set(inode_key, new_attribute_data, strlen(new_attribute_data));
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
 
-        free(new_attribute_data);
+    if (update_dentries(from_fuse_ino(parent), (char *)name, -1, DT_UNKNOWN) != 0)
+    {
+        fuse_reply_err(req, EIO);
+        return;
     }
 
-    free(inode_key);
-    free(attribute_data);
+    unlink_inode(inode_value);
 
-    return 0;
+    fuse_reply_err(req, 0);
 }
 
-static int memcached_getxattr(const char *path, const char *name, char *value, size_t size)
+static void memcached_ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
 {
-    int inode_value = hashable_get_entry((char *)path);
-    char *inode_key = int_to_string(inode_value);
+    int inode_value = find_dentry(from_fuse_ino(parent), name, NULL);
 
-    char *attribute_data = memcached_get(inode_key);
+    if (inode_value == -1)
+    {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
 
-    char *attr_value = get_attr_value_str(attribute_data, (char *)name);
-    if (attr_value == NULL)
+    if (!dir_is_empty(inode_value))
     {
-        free(inode_key);
-        free(attribute_data);
+        fuse_reply_err(req, ENOTEMPTY);
+        return;
+    }
 
-        return 0;
+    if (update_dentries(from_fuse_ino(parent), (char *)name, -1, DT_UNKNOWN) != 0)
+    {
+        fuse_reply_err(req, EIO);
+        return;
     }
-    else
+
+    unlink_inode(inode_value);
+
+    fuse_reply_err(req, 0);
+}
+
+static void memcached_ll_rename(fuse_req_t req, fuse_ino_t parent, const char *name, fuse_ino_t newparent,
+                                const char *newname, unsigned int flags)
+{
+    fuse_reply_err(req, -rename_dentry(from_fuse_ino(parent), (char *)name, from_fuse_ino(newparent),
+                                       (char *)newname, flags));
+}
+
+static void memcached_ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    int inode_value = from_fuse_ino(ino);
+
+    inode_t inode;
+    char *record = NULL;
+
+    if (get_inode(inode_value, &inode, &record) != 0)
     {
-        size_t attr_value_size = strlen(attr_value);
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
 
-        if (size == 0)
-        {
-            size = attr_value_size;
-        }
-        else
-        {
-            if (size > attr_value_size)
-                size = attr_value_size;
-            memcpy(value, attr_value, size);
-        }
+    fi->fh = (uintptr_t)open_file_handle(inode_value, inode_block_size(&inode), &inode.attrs);
 
-        free(inode_key);
-        free(attr_value);
-        free(attribute_data);
+    free(record);
 
-        return size;
+    if (fuse_reply_open(req, fi) != 0) // request was interrupted, file is not opened
+    {
+        close_open_file((open_file *)(uintptr_t)fi->fh);
     }
 }
 
-static int memcached_listxattr(const char *path, char *list, size_t size)
+static void memcached_ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
 {
-    int inode_value = hashable_get_entry((char *)path);
-    char *inode_key = int_to_string(inode_value);
+    // blocks buffered by this handle are stored first, so they are read back
+    if (flush_file_info(fi) != 0)
+    {
+        fuse_reply_err(req, EIO);
+        return;
+    }
 
-    char *attribute_data = memcached_get(inode_key);
+    char *buf = (char *)malloc(size);
 
-    struct list *extended_attributes = get_extended_attrs_list(attribute_data);
+    int read = read_inode(from_fuse_ino(ino), buf, size, off, (open_file *)(uintptr_t)fi->fh);
 
-    if (size == 0)
+    if (read < 0)
     {
-        size = extended_attributes->size;
+        fuse_reply_err(req, -read);
     }
     else
     {
-        if (size > extended_attributes->size)
-            size = extended_attributes->size;
-        if (size > 0)
-        {
-            memcpy(list, extended_attributes->keys, size);
-        }
+        fuse_reply_buf(req, buf, read);
     }
 
-    free(inode_key);
-    free(attribute_data);
-    free(extended_attributes->keys);
-    free(extended_attributes);
-
-    return size;
+    free(buf);
 }
 
-static int memcached_removexattr(const char *path, const char *name)
+static void memcached_ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_t off,
+                               struct fuse_file_info *fi)
 {
-    int inode_value = hashable_get_entry((char *)path);
-    char *inode_key = int_to_string(inode_value);
+    int written = write_inode(from_fuse_ino(ino), buf, size, off, (open_file *)(uintptr_t)fi->fh);
 
-    char *attribute_data = memcached_get(inode_key);
-
-    char *result_data = remove_extended_attr(attribute_data, (char *)name);
-
-    if (result_data != NULL)
+    if (written < 0)
+    {
+        fuse_reply_err(req, -written);
+    }
+    else
     {
-        memcached_set(inode_key, result_data, strlen(result_data));
+        fuse_reply_write(req, written);
     }
+}
 
-    free(inode_key);
-    free(attribute_data);
-    free(result_data);
+static void memcached_ll_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    fuse_reply_err(req, -flush_file_info(fi));
+}
 
-    return 0;
+static void memcached_ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi)
+{
+    fuse_reply_err(req, -flush_file_info(fi));
 }
 
-static int memcached_chmod(const char *path, mode_t mode, struct fuse_file_info *fi)
+static void memcached_ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
 {
-    int inode_value = hashable_get_entry((char *)path);
-    char *inode_key = int_to_string(inode_value);
-    char *attribute_data = memcached_get(inode_key);
+    fuse_reply_err(req, -memcached_release(NULL, fi));
+}
+
+static void memcached_ll_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    fuse_reply_open(req, fi);
+}
 
-    unsigned long current_mode = get_attr_value(attribute_data, "st_mode");
+/* offsets are same as offsets of readdir_dentries */
 
-    char *new_attribute_data = modify_attr(attribute_data, "st_mode", mode);
+typedef struct ll_readdir_buffer
+{
+    fuse_req_t req;
+    int dir_value;
+    char *buf;
+    size_t size;
+    size_t used;
+    int plus;
+} ll_readdir_buffer;
+
+/* adds entry to reply, stbuf has attributes of entry's inode (readdirplus) or only its type. returns 1 if buffer
+   is full, rest is read by next call */
+
+static int add_direntry(ll_readdir_buffer *readdir, const char *name, int inode_value, struct stat *stbuf, off_t next)
+{
+    char *buf = readdir->buf + readdir->used;
+    size_t left = readdir->size - readdir->used;
+    size_t entry_size;
 
-    memcached_set(inode_key, new_attribute_data, strlen(new_attribute_data));
+    struct fuse_entry_param e;
+    memset(&e, 0, sizeof(struct fuse_entry_param));
 
-    free(attribute_data);
-    free(new_attribute_data);
-    free(inode_key);
+    if (!readdir->plus)
+    {
+        entry_size = fuse_add_direntry(readdir->req, buf, left, name, stbuf, next);
+    }
+    else
+    {
+        if (inode_value != -1) // ino 0 (".", "..", inode that is gone) gives name without entry
+        {
+            e.ino = to_fuse_ino(inode_value);
+            e.attr_timeout = options.attr_timeout;
+            e.entry_timeout = options.entry_timeout;
+        }
+
+        e.attr = *stbuf;
+
+        entry_size = fuse_add_direntry_plus(readdir->req, buf, left, name, &e, next);
+    }
+
+    if (entry_size > left)
+    {
+        return 1;
+    }
+
+    readdir->used += entry_size;
+
+    if (e.ino != 0) // kernel counts lookup of every entry it gets with inode
+    {
+        node_lookup(inode_value, readdir->dir_value);
+    }
 
     return 0;
 }
 
-static int memcached_chown(const char *path, uid_t uid, gid_t gid, struct fuse_file_info *fi)
+static int add_type_direntry(ll_readdir_buffer *readdir, const char *name, int inode_value, int type, off_t next)
 {
-    if (uid == -1 && gid == -1)
-        return 0;
+    struct stat stbuf;
+    memset(&stbuf, 0, sizeof(struct stat));
+    stbuf.st_ino = inode_value;
+    stbuf.st_mode = DTTOIF(type);
 
-    int inode_value = hashable_get_entry((char *)path);
-    char *inode_key = int_to_string(inode_value);
-    char *attribute_data = memcached_get(inode_key);
+    return add_direntry(readdir, name, -1, &stbuf, next);
+}
 
-    char *new_attribute_data = NULL;
+static int ll_fill_dentry(void *ctx, dentry *entry, struct stat *stbuf)
+{
+    ll_readdir_buffer *readdir = (ll_readdir_buffer *)ctx;
 
-    if (uid != -1)
+    if (stbuf == NULL)
     {
-        new_attribute_data = modify_attr(attribute_data, "st_uid", uid);
+        return add_type_direntry(readdir, entry->name, entry->inode_value, entry->type, entry->hash + 3);
     }
 
-    if (gid != -1)
+    return add_direntry(readdir, entry->name, entry->inode_value, stbuf, entry->hash + 3);
+}
+
+static void ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, int plus)
+{
+    ll_readdir_buffer readdir = {req, from_fuse_ino(ino), (char *)malloc(size), size, 0, plus};
+
+    int full = (off < 1 && add_type_direntry(&readdir, ".", from_fuse_ino(ino), DT_DIR, 1));
+    full = full || (off < 2 && add_type_direntry(&readdir, "..", from_fuse_ino(ino), DT_DIR, 2));
+
+    if (!full)
     {
-        char *data_to_change = (new_attribute_data == NULL) ? attribute_data : new_attribute_data;
-        new_attribute_data = modify_attr(data_to_change, "st_gid", gid);
+        readdir_dentries(from_fuse_ino(ino), off, plus, ll_fill_dentry, &readdir);
     }
 
-    memcached_set(inode_key, new_attribute_data, strlen(new_attribute_data));
+    fuse_reply_buf(req, readdir.buf, readdir.used);
 
-    free(new_attribute_data);
-    free(attribute_data);
-    free(inode_key);
+    free(readdir.buf);
+}
 
-    return 0;
+static void memcached_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
+{
+    ll_readdir(req, ino, size, off, 0);
 }
 
-static int memcached_link(const char *oldpath, const char *newpath)
+/* entries come with attributes (and count as lookups), so ls -l needs no lookup or getattr per entry */
+
+static void memcached_ll_readdirplus(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
 {
-    int inode_value = hashable_get_entry((char *)oldpath);
+    ll_readdir(req, ino, size, off, 1);
+}
 
-    char *inode_key = int_to_string(inode_value);
-    char *attribute_data = memcached_get(inode_key);
-    unsigned long st_nlink = get_attr_value(attribute_data, "st_nlink");
-    char *modified_data = modify_attr(attribute_data, "st_nlink", st_nlink + 1);
-    memcached_set(inode_key, modified_data, strlen(modified_data));
+static void memcached_ll_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    fuse_reply_err(req, 0);
+}
 
-    hashtable_add_entry((char *)newpath, inode_value);
+static void memcached_ll_statfs(fuse_req_t req, fuse_ino_t ino)
+{
+    struct statvfs statv;
+    memset(&statv, 0, sizeof(struct statvfs));
 
-    char *inode_table = memcached_get("inode_table");
-    char *new_inode_table = add_inode_to_table(inode_table, (char *)newpath, inode_value);
-    memcached_set("inode_table", new_inode_table, strlen(new_inode_table));
+    statv.f_bsize = options.block_size;
+    statv.f_namemax = NAME_MAX;
 
-    add_link_to_parent_dir((char *)newpath);
+    fuse_reply_statfs(req, &statv);
+}
 
-    return 0;
+static void memcached_ll_setxattr(fuse_req_t req, fuse_ino_t ino, const char *name, const char *value,
+                                  size_t size, int flags)
+{
+    fuse_reply_err(req, -setxattr_inode(from_fuse_ino(ino), name, value, size));
 }
 
-static int memcached_symlink(const char *linkname, const char *path)
+static void memcached_ll_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name, size_t size)
 {
-    char *parent_dir = get_parent_directory(path);
+    char *value = (size > 0) ? (char *)malloc(size) : NULL;
 
-    create_inode((char *)path, S_IFLNK | 0777, 1, getuid(), getgid(), strlen(linkname), (char *)linkname);
+    int value_size = getxattr_inode(from_fuse_ino(ino), name, value, size);
 
-    return 0;
+    if (value_size < 0)
+    {
+        fuse_reply_err(req, -value_size);
+    }
+    else if (size == 0)
+    {
+        fuse_reply_xattr(req, value_size);
+    }
+    else
+    {
+        fuse_reply_buf(req, value, value_size);
+    }
+
+    free(value);
 }
 
-static int memcached_readlink(const char *path, char *buf, size_t size)
+static void memcached_ll_listxattr(fuse_req_t req, fuse_ino_t ino, size_t size)
 {
-    int inode_value = hashable_get_entry((char *)path);
+    char *list = (size > 0) ? (char *)malloc(size) : NULL;
 
-    char *inode_key = int_to_string(inode_value);
-    char *attribute_data = memcached_get(inode_key);
+    int list_size = listxattr_inode(from_fuse_ino(ino), list, size);
+
+    if (list_size < 0)
+    {
+        fuse_reply_err(req, -list_size);
+    }
+    else if (size == 0)
+    {
+        fuse_reply_xattr(req, list_size);
+    }
+    else
+    {
+        fuse_reply_buf(req, list, list_size);
+    }
 
-    char *content = get_attr_value_str(attribute_data, "st_content");
+    free(list);
+}
+
+static void memcached_ll_removexattr(fuse_req_t req, fuse_ino_t ino, const char *name)
+{
+    fuse_reply_err(req, -removexattr_inode(from_fuse_ino(ino), name));
+}
 
-    size_t content_size = strlen(content);
+static const struct fuse_lowlevel_ops memcached_ll_oper =
+    {
+        .init = memcached_ll_init,
+        .destroy = memcached_ll_destroy,
+        .lookup = memcached_ll_lookup,
+        .forget = memcached_ll_forget,
+        .forget_multi = memcached_ll_forget_multi,
+        .getattr = memcached_ll_getattr,
+        .setattr = memcached_ll_setattr,
+        .readlink = memcached_ll_readlink,
+        .mkdir = memcached_ll_mkdir,
+        .unlink = memcached_ll_unlink,
+        .rmdir = memcached_ll_rmdir,
+        .rename = memcached_ll_rename,
+        .symlink = memcached_ll_symlink,
+        .link = memcached_ll_link,
+        .open = memcached_ll_open,
+        .read = memcached_ll_read,
+        .write = memcached_ll_write,
+        .flush = memcached_ll_flush,
+        .release = memcached_ll_release,
+        .fsync = memcached_ll_fsync,
+        .opendir = memcached_ll_opendir,
+        .readdir = memcached_ll_readdir,
+        .readdirplus = memcached_ll_readdirplus,
+        .releasedir = memcached_ll_releasedir,
+        .statfs = memcached_ll_statfs,
+        .setxattr = memcached_ll_setxattr,
+        .getxattr = memcached_ll_getxattr,
+        .listxattr = memcached_ll_listxattr,
+        .removexattr = memcached_ll_removexattr,
+        .create = memcached_ll_create,
+};
+
+/* runs fuse session with low-level interface, same command line as fuse_main */
+
+static int run_lowlevel(struct fuse_args *args)
+{
+    struct fuse_cmdline_opts opts;
+
+    if (fuse_parse_cmdline(args, &opts) != 0)
+    {
+        return 1;
+    }
 
-    if (size != content_size)
+    if (opts.mountpoint == NULL)
     {
-        size = content_size;
+        printf("no mountpoint given \n");
+        return 1;
     }
 
-    memcpy(buf, content, content_size);
+    int ret = 1;
 
-    return 0;
+    struct fuse_session *se = fuse_session_new(args, &memcached_ll_oper, sizeof(memcached_ll_oper), NULL);
+
+    if (se != NULL)
+    {
+        if (fuse_set_signal_handlers(se) == 0)
+        {
+            if (fuse_session_mount(se, opts.mountpoint) == 0)
+            {
+                fuse_daemonize(opts.foreground);
+
+                ret = opts.singlethread ? fuse_session_loop(se) : fuse_session_loop_mt(se, opts.clone_fd);
+
+                fuse_session_unmount(se);
+            }
+
+            fuse_remove_signal_handlers(se);
+        }
+
+        fuse_session_destroy(se);
+    }
+
+    free(opts.mountpoint);
+
+    return ret;
 }
 
 int main(int argc, char *argv[])
 {
     int ret;
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+
+    options.connections = DEFAULT_CONNECTIONS;
+    options.block_cache_mb = DEFAULT_BLOCK_CACHE_MB;
+    options.writeback_kb = DEFAULT_WRITEBACK_KB;
+    options.readahead_kb = DEFAULT_READAHEAD_KB;
+    options.block_size = FILE_BLOCK_SIZE;
+    options.inline_size = DEFAULT_INLINE_SIZE;
+    options.attr_timeout = DEFAULT_ATTR_TIMEOUT;
+    options.entry_timeout = DEFAULT_ENTRY_TIMEOUT;
+    options.negative_timeout = DEFAULT_NEGATIVE_TIMEOUT;
+    options.path_cache = DEFAULT_PATH_CACHE;
+
+    if (fuse_opt_parse(&args, &options, option_spec, option_proc) == -1)
+    {
+        return 1;
+    }
+
+    if (options.lowlevel)
+    {
+        ret = run_lowlevel(&args);
+    }
+    else
+    {
+        ret = fuse_main(args.argc, args.argv, &memcached_oper, NULL);
+    }
 
-    ret = fuse_main(argc, argv, &memcached_oper, NULL);
+    fuse_opt_free_args(&args);
 
     return ret;
 }
\ No newline at end of file
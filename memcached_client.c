@@ -1,263 +1,2979 @@
 #define PORT 11211
 #define MAX_COMMAND_SIZE 2000
+#define READ_BUFFER_SIZE 16384
+#define WRITE_BUFFER_SIZE 65536
+#define DIRECT_READ_SIZE 4096
+#define POINTS_PER_WEIGHT 160
+#define URING_MIN_ENTRIES 64
+#define EPOLL_MAX_EVENTS 64
+#define UDP_HEADER_SIZE 8
+#define UDP_MAX_PAYLOAD 1400
+#define UDP_MAX_DATAGRAMS 64
+#define UDP_MAX_DATAGRAM_SIZE 65536
+#define UDP_VALUE_LINE_SIZE 48
+#define UDP_MAX_VALUE_SIZE 4096
+#define UDP_TIMEOUT_MS 50
+#define UDP_RETRIES 3
 
 #include <stdio.h>
+#include <stdint.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+#include <poll.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <netdb.h>
 #include <unistd.h>
-#include <sys/ioctl.h>
+#include <fcntl.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <linux/io_uring.h>
 
 #include "memcached_client.h"
 #include "data_parser.h"
 
-int sfd;
+struct server;
 
-static char *get_storage_command(char *command_name, char *key, char *value, size_t *count)
+typedef struct connection
 {
-    size_t key_size = strlen(key);
-    size_t command_size = strlen(command_name);
+    int sfd;
+    char *rbuf; /* bytes read from socket but not yet parsed are rbuf[rbuf_start..rbuf_end) */
+    size_t rbuf_capacity;
+    size_t rbuf_start;
+    size_t rbuf_end;
 
-    char *bytes = int_to_string(*(int *)count);
+    char *wbuf; /* bytes being sent are wbuf[wbuf_sent..wbuf_size) */
+    size_t wbuf_capacity;
+    size_t wbuf_size;
+    size_t wbuf_sent;
+    char *next_wbuf; /* commands encoded while wbuf is being sent, they go out after it */
+    size_t next_wbuf_capacity;
+    size_t next_wbuf_size;
+
+    memcached_request *pending; /* requests sent and waiting for response, in order of sending */
+    memcached_request *pending_tail;
+
+    memcached_request *body_request; /* request whose data block is being read */
+    size_t body_bytes;               /* size of data block with its \r\n */
+    size_t body_position;
+    int skip_end; /* first pending request is done, but END of its ascii retrieval did not come yet */
+    int next_opaque;
+
+    int sending;     /* io_uring send is in flight */
+    int receiving;   /* io_uring recv is in flight */
+    int recv_direct; /* in-flight recv reads straight into range of body_request */
+    int failed;      /* socket is shut down, reconnect waits for in-flight operations */
+    int epoll_fd;    /* epoll socket is registered in, -1 if none */
+
+    struct memcached_async *owner;
+    struct server *server;
+    struct connection *next; /* next free connection in pool */
+} connection;
+
+/* every server has its own pool of connections */
+typedef struct server
+{
+    char *name; /* host:port or socket path, used for placing server on ring */
+    char *host;
+    int port;
+    char *socket_path; /* unix domain socket, NULL for tcp */
+    int weight;
+
+    connection *connections;
+    connection *free_connections;
+    int num_connections;
+
+    pthread_mutex_t pool_lock;
+    pthread_cond_t pool_cond;
+} server;
+
+/* point of consistent hash ring. key belongs to server of first point with hash >= hash of key */
+typedef struct ring_point
+{
+    unsigned int hash;
+    int server_index;
+} ring_point;
+
+/* Requests of one caller. Submitted requests are queued until caller reaps, then they are encoded into
+   connections of their servers (held until memcached_async_end) and all connections are driven together. */
+struct memcached_async
+{
+    connection **conns; /* conns[s] is connection to server s, NULL if none is held */
+    int max_held;
+    memcached_request *queued; /* submitted, not yet encoded */
+    memcached_request *queued_tail;
+    memcached_request *completed; /* completed, not yet reaped */
+    memcached_request *completed_tail;
+    int in_flight; /* encoded, not yet completed */
+};
+
+/* io_uring without liburing: rings are mmap-ed from io_uring fd and driven with raw syscalls */
+typedef struct uring
+{
+    int fd;
+    unsigned int entries;
+    unsigned int to_submit;
+
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    struct io_uring_sqe *sqes;
+
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+} uring;
+
+/* Every thread drives its requests with its own ring (or epoll instance if io_uring is not available).
+   udp sockets are per thread too, so threads never receive each others datagrams. */
+typedef struct thread_engine
+{
+    uring *ring;
+    int epoll_fd;
+    int *udp_sockets; /* udp_sockets[s] for server s, -1 if not opened yet */
+    unsigned short next_udp_id;
+} thread_engine;
+
+static server *servers = NULL;
+static int num_servers = 0;
+
+static ring_point *ring = NULL;
+static int num_points = 0;
+
+static int protocol = PROTOCOL_ASCII;
+static int engine = ENGINE_URING;
+static int udp_enabled = 0;
+
+static pthread_key_t engine_key;
+static pthread_once_t engine_key_once = PTHREAD_ONCE_INIT;
+
+/* blocks until some connection of server is free. connection is used only by calling thread until released */
+
+static connection *acquire_connection(server *srv)
+{
+    pthread_mutex_lock(&srv->pool_lock);
+
+    while (srv->free_connections == NULL)
+    {
+        pthread_cond_wait(&srv->pool_cond, &srv->pool_lock);
+    }
+
+    connection *conn = srv->free_connections;
+    srv->free_connections = conn->next;
+
+    pthread_mutex_unlock(&srv->pool_lock);
+
+    return conn;
+}
+
+/* same as acquire_connection, but returns NULL instead of waiting */
+
+static connection *try_acquire_connection(server *srv)
+{
+    pthread_mutex_lock(&srv->pool_lock);
+
+    connection *conn = srv->free_connections;
+
+    if (conn != NULL)
+    {
+        srv->free_connections = conn->next;
+    }
+
+    pthread_mutex_unlock(&srv->pool_lock);
+
+    return conn;
+}
+
+static void release_connection(connection *conn)
+{
+    server *srv = conn->server;
+
+    pthread_mutex_lock(&srv->pool_lock);
+
+    conn->next = srv->free_connections;
+    srv->free_connections = conn;
+
+    pthread_cond_signal(&srv->pool_cond);
+    pthread_mutex_unlock(&srv->pool_lock);
+}
+
+/* fnv-1a with final mixing, so keys differing in last character (1_b_1, 1_b_2) land far from each other */
+
+static unsigned int hash_key(char *key, size_t size)
+{
+    unsigned int hash = 2166136261u;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= (unsigned char)key[i];
+        hash *= 16777619u;
+    }
+
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+
+    return hash;
+}
+
+static int compare_points(const void *a, const void *b)
+{
+    unsigned int hash_a = ((ring_point *)a)->hash;
+    unsigned int hash_b = ((ring_point *)b)->hash;
+
+    return (hash_a > hash_b) - (hash_a < hash_b);
+}
+
+/* Ketama style ring: every server gets POINTS_PER_WEIGHT * weight points, hashes of "name-i".
+   Points of server depend only on its name, so adding a server moves only keys that fall
+   before its new points, all other keys stay on their servers. */
+
+static void build_ring()
+{
+    num_points = 0;
+
+    for (int i = 0; i < num_servers; i++)
+    {
+        num_points += POINTS_PER_WEIGHT * servers[i].weight;
+    }
+
+    ring = (ring_point *)malloc(num_points * sizeof(ring_point));
 
-    size_t full_command_size = command_size + 1 + key_size + 5 + strlen(bytes) + 1 + *count + 2;
-    char *command = (char *)malloc(full_command_size + 1);
     int index = 0;
+    for (int i = 0; i < num_servers; i++)
+    {
+        for (int j = 0; j < POINTS_PER_WEIGHT * servers[i].weight; j++)
+        {
+            char point_name[MAX_COMMAND_SIZE];
+            int point_name_size = snprintf(point_name, MAX_COMMAND_SIZE, "%s-%d", servers[i].name, j);
+
+            ring[index].hash = hash_key(point_name, point_name_size);
+            ring[index].server_index = i;
+            index += 1;
+        }
+    }
+
+    qsort(ring, num_points, sizeof(ring_point), compare_points);
+}
+
+static int get_server_index(char *key)
+{
+    if (num_servers == 1)
+    {
+        return 0;
+    }
+
+    unsigned int hash = hash_key(key, strlen(key));
+
+    int low = 0;
+    int high = num_points;
+
+    while (low < high)
+    {
+        int middle = (low + high) / 2;
+
+        if (ring[middle].hash < hash)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    if (low == num_points) // wraps around
+    {
+        low = 0;
+    }
+
+    return ring[low].server_index;
+}
+
+/* memcached started with -s <path> on the same host, skips tcp/ip stack entirely. returns -1 if server can
+   not be reached */
+
+static int open_unix_socket(server *srv)
+{
+    struct sockaddr_un addr;
+    int sfd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (sfd == -1)
+    {
+        perror(NULL);
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(struct sockaddr_un));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, srv->socket_path, sizeof(addr.sun_path) - 1);
+
+    int connection_status = connect(sfd, (struct sockaddr *)&addr, sizeof(struct sockaddr_un));
+
+    if (connection_status == -1)
+    {
+        perror(srv->name);
+        close(sfd);
+        return -1;
+    }
+
+    return sfd;
+}
+
+static int get_server_address(server *srv, struct sockaddr_in *addr)
+{
+    memset(addr, 0, sizeof(struct sockaddr_in));
+
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(srv->port);
+
+    addr->sin_addr.s_addr = inet_addr(srv->host);
+
+    if (addr->sin_addr.s_addr == INADDR_NONE)
+    {
+        struct hostent *host = gethostbyname(srv->host);
+
+        if (host == NULL)
+        {
+            printf("unknown host: %s\n", srv->host);
+            errno = EINVAL;
+            return -1;
+        }
+
+        memcpy(&addr->sin_addr, host->h_addr_list[0], sizeof(addr->sin_addr));
+    }
+
+    return 0;
+}
+
+static int open_tcp_socket(server *srv)
+{
+    struct sockaddr_in addr;
+    int sfd = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (sfd == -1)
+    {
+        perror(NULL);
+        return -1;
+    }
+
+    if (get_server_address(srv, &addr) == -1)
+    {
+        close(sfd);
+        return -1;
+    }
+
+    int connection_status = connect(sfd, (struct sockaddr *)&addr, sizeof(struct sockaddr_in));
+
+    if (connection_status == -1)
+    {
+        perror(srv->name);
+        close(sfd);
+        return -1;
+    }
+
+    return sfd;
+}
+
+/* memcached started with -U <port>, udp port is assumed to be the same as tcp port */
+
+static int open_udp_socket(server *srv)
+{
+    struct sockaddr_in addr;
+    int sfd = socket(AF_INET, SOCK_DGRAM, 0);
+
+    if (sfd == -1)
+    {
+        perror(NULL);
+        return -1;
+    }
+
+    if (get_server_address(srv, &addr) == -1)
+    {
+        close(sfd);
+        return -1;
+    }
+
+    if (connect(sfd, (struct sockaddr *)&addr, sizeof(struct sockaddr_in)) == -1)
+    {
+        perror(srv->name);
+        close(sfd);
+        return -1;
+    }
+
+    return sfd;
+}
+
+/* connects blocking, epoll engine then switches socket to non-blocking mode. returns -1 if connect failed */
+
+static int open_socket(server *srv)
+{
+    int sfd = (srv->socket_path != NULL) ? open_unix_socket(srv) : open_tcp_socket(srv);
+
+    if (sfd != -1 && engine == ENGINE_EPOLL)
+    {
+        fcntl(sfd, F_SETFL, fcntl(sfd, F_GETFL) | O_NONBLOCK);
+    }
+
+    return sfd;
+}
+
+static void append_to_buffer(char **buffer, size_t *size, size_t *capacity, char *data, size_t count)
+{
+    if (*size + count > *capacity)
+    {
+        while (*size + count > *capacity)
+        {
+            *capacity *= 2;
+        }
+
+        *buffer = (char *)realloc(*buffer, *capacity);
+    }
+
+    memcpy(*buffer + *size, data, count);
+    *size += count;
+}
+
+/* returns value of flag in meta response line ("VA 10 O3 c7" - value of O is "3"), NULL if flag is not present */
+
+static char *get_meta_flag(char *line, char flag)
+{
+    char *token = strchr(line, ' ');
+
+    while (token != NULL)
+    {
+        token += 1;
+
+        if (*token == flag)
+        {
+            return token + 1;
+        }
+
+        token = strchr(token, ' ');
+    }
+
+    return NULL;
+}
+
+/* requests that return value */
+
+static int is_retrieval(memcached_request *request)
+{
+    return request->type == REQUEST_GET || request->type == REQUEST_GETS || request->type == REQUEST_INCR;
+}
+
+/* removes first pending request of connection and hands it to its caller */
+
+static void complete_head(connection *conn, int status)
+{
+    memcached_request *request = conn->pending;
+
+    conn->pending = request->next;
+
+    if (conn->pending == NULL)
+    {
+        conn->pending_tail = NULL;
+    }
+
+    request->status = status;
+    request->next = NULL;
+
+    if (status != 1 && is_retrieval(request) && request->range == NULL)
+    {
+        free(request->value);
+        request->value = NULL;
+    }
+
+    memcached_async *ctx = conn->owner;
+    ctx->in_flight -= 1;
+
+    if (request->internal)
+    {
+        free(request);
+        return;
+    }
+
+    if (ctx->completed_tail != NULL)
+    {
+        ctx->completed_tail->next = request;
+    }
+    else
+    {
+        ctx->completed = request;
+    }
+    ctx->completed_tail = request;
+}
+
+/* Writes command of request into connection output and appends request to pending ones.
+   ascii gets following each other are joined into one "get k1 k2 ... kN" command: previous and next
+   are neighbouring requests for the same server, last_in_group marks key that ends the command. */
+
+static void encode_request(connection *conn, memcached_request *request, memcached_request *previous,
+                           memcached_request *next)
+{
+    char header[MAX_COMMAND_SIZE];
+    int header_size = 0;
+    int has_value = 0;
+
+    char *key = request->key;
+    char *encoded_key = NULL;
+
+    if (protocol == PROTOCOL_META && key != NULL)
+    {
+        encoded_key = base64_encode(key, strlen(key));
+    }
+
+    request->last_in_group = 1;
+
+    switch (request->type)
+    {
+    case REQUEST_GET:
+        if (protocol == PROTOCOL_META) // quiet, only hits reply and their O<i> says which get they answer
+        {
+            request->opaque = conn->next_opaque;
+            conn->next_opaque += 1;
+
+            header_size = snprintf(header, MAX_COMMAND_SIZE, "mg %s b v q O%d\r\n", encoded_key, request->opaque);
+        }
+        else
+        {
+            int joined_to_previous = (previous != NULL && previous->type == REQUEST_GET && !previous->last_in_group);
+            int joined_to_next = (next != NULL && next->type == REQUEST_GET);
+
+            request->last_in_group = !joined_to_next;
+
+            header_size = snprintf(header, MAX_COMMAND_SIZE, "%s%s%s", joined_to_previous ? " " : "get ", key,
+                                   joined_to_next ? "" : "\r\n");
+        }
+        break;
+    case REQUEST_GETS:
+        if (protocol == PROTOCOL_META)
+        {
+            header_size = snprintf(header, MAX_COMMAND_SIZE, "mg %s b v c\r\n", encoded_key);
+        }
+        else
+        {
+            header_size = snprintf(header, MAX_COMMAND_SIZE, "gets %s\r\n", key);
+        }
+        break;
+    case REQUEST_SET:
+    case REQUEST_ADD:
+        if (protocol == PROTOCOL_META)
+        {
+            header_size = snprintf(header, MAX_COMMAND_SIZE, "ms %s %zu b%s\r\n", encoded_key, request->count,
+                                   (request->type == REQUEST_ADD) ? " ME" : "");
+        }
+        else
+        {
+            header_size = snprintf(header, MAX_COMMAND_SIZE, "%s %s 0 0 %zu\r\n",
+                                   (request->type == REQUEST_ADD) ? "add" : "set", key, request->count);
+        }
+        has_value = 1;
+        break;
+    case REQUEST_CAS:
+        if (protocol == PROTOCOL_META)
+        {
+            header_size = snprintf(header, MAX_COMMAND_SIZE, "ms %s %zu b C%llu\r\n", encoded_key, request->count,
+                                   request->cas);
+        }
+        else
+        {
+            header_size = snprintf(header, MAX_COMMAND_SIZE, "cas %s 0 0 %zu %llu\r\n", key, request->count,
+                                   request->cas);
+        }
+        has_value = 1;
+        break;
+    case REQUEST_SET_QUIET:
+        request->opaque = conn->next_opaque;
+        conn->next_opaque += 1;
+
+        if (protocol == PROTOCOL_META)
+        {
+            header_size = snprintf(header, MAX_COMMAND_SIZE, "ms %s %zu b q O%d\r\n", encoded_key, request->count,
+                                   request->opaque);
+        }
+        else
+        {
+            header_size = snprintf(header, MAX_COMMAND_SIZE, "set %s 0 0 %zu noreply\r\n", key, request->count);
+        }
+        request->status = 1; // until server reports failure
+        has_value = 1;
+        break;
+    case REQUEST_DELETE:
+        if (protocol == PROTOCOL_META)
+        {
+            header_size = snprintf(header, MAX_COMMAND_SIZE, "md %s b\r\n", encoded_key);
+        }
+        else
+        {
+            header_size = snprintf(header, MAX_COMMAND_SIZE, "delete %s\r\n", key);
+        }
+        break;
+    case REQUEST_INCR:
+        if (protocol == PROTOCOL_META)
+        {
+            header_size = snprintf(header, MAX_COMMAND_SIZE, "ma %s b D%zu v\r\n", encoded_key, request->count);
+        }
+        else
+        {
+            header_size = snprintf(header, MAX_COMMAND_SIZE, "incr %s %zu\r\n", key, request->count);
+        }
+        break;
+    case REQUEST_NOOP:
+        header_size = snprintf(header, MAX_COMMAND_SIZE, "mn\r\n");
+        break;
+    case REQUEST_FLUSH:
+        header_size = snprintf(header, MAX_COMMAND_SIZE, "flush_all\r\n");
+        break;
+    }
+
+    free(encoded_key);
+
+    append_to_buffer(&conn->next_wbuf, &conn->next_wbuf_size, &conn->next_wbuf_capacity, header, header_size);
+
+    if (has_value)
+    {
+        append_to_buffer(&conn->next_wbuf, &conn->next_wbuf_size, &conn->next_wbuf_capacity, request->value,
+                         request->count);
+        append_to_buffer(&conn->next_wbuf, &conn->next_wbuf_size, &conn->next_wbuf_capacity, "\r\n", 2);
+    }
+
+    request->next = NULL;
+
+    if (conn->pending_tail != NULL)
+    {
+        conn->pending_tail->next = request;
+    }
+    else
+    {
+        conn->pending = request;
+    }
+    conn->pending_tail = request;
+}
+
+/* Copies next line of response (without \r\n) into line. returns number of bytes line takes in
+   connection buffer, 0 if it did not arrive whole yet */
+
+static size_t peek_line(connection *conn, char *line)
+{
+    char *start = conn->rbuf + conn->rbuf_start;
+    size_t available = conn->rbuf_end - conn->rbuf_start;
+
+    char *end = (char *)memchr(start, '\n', available);
+
+    if (end == NULL)
+    {
+        return 0;
+    }
+
+    size_t line_size = end - start;
+
+    if (line_size > 0 && start[line_size - 1] == '\r')
+    {
+        line_size -= 1;
+    }
+
+    if (line_size >= MAX_COMMAND_SIZE)
+    {
+        line_size = MAX_COMMAND_SIZE - 1;
+    }
+
+    memcpy(line, start, line_size);
+    line[line_size] = '\0';
+
+    return end - start + 1;
+}
+
+/* data block of bytes length follows, it is read into first pending request */
+
+static void start_body(connection *conn, size_t bytes)
+{
+    memcached_request *request = conn->pending;
+
+    if (request->range == NULL)
+    {
+        request->value = (char *)malloc(bytes + 1);
+    }
+
+    conn->body_request = request;
+    conn->body_bytes = bytes + 2;
+    conn->body_position = 0;
+}
+
+/* Copies buffered part of data block into its request: only part [offset, offset + size) of range
+   (or whole value) is kept, rest is skipped. returns 1 when whole block with its \r\n was read */
+
+static int read_body(connection *conn)
+{
+    memcached_request *request = conn->body_request;
+
+    size_t bytes = conn->body_bytes - 2;
+    size_t available = conn->rbuf_end - conn->rbuf_start;
+    size_t position = conn->body_position;
+    size_t n = (available < conn->body_bytes - position) ? available : conn->body_bytes - position;
+
+    char *dest = request->value;
+    size_t offset = 0;
+    size_t end = bytes;
+
+    if (request->range != NULL)
+    {
+        dest = request->range->dest;
+        offset = request->range->offset;
+        end = (offset + request->range->size < bytes) ? offset + request->range->size : bytes;
+    }
+
+    size_t copy_from = (position > offset) ? position : offset;
+    size_t copy_to = (position + n < end) ? position + n : end;
+
+    if (copy_from < copy_to)
+    {
+        memcpy(dest + copy_from - offset, conn->rbuf + conn->rbuf_start + copy_from - position, copy_to - copy_from);
+    }
+
+    conn->rbuf_start += n;
+    conn->body_position += n;
+
+    if (conn->body_position < conn->body_bytes)
+    {
+        return 0;
+    }
+
+    conn->body_request = NULL;
+
+    if (request->range != NULL)
+    {
+        request->range->read = (end > offset) ? end - offset : 0;
+    }
+    else
+    {
+        request->value[bytes] = '\0';
+        request->count = bytes;
+    }
+
+    if (protocol == PROTOCOL_ASCII && request->last_in_group) // END closes ascii retrieval command
+    {
+        request->status = 1;
+        conn->skip_end = 1;
+    }
+    else
+    {
+        complete_head(conn, 1);
+    }
+
+    return 1;
+}
+
+/* Quiet stores reply only when they fail. returns pending quiet store that line reports failure of,
+   NULL if line is response to request sent after them. ascii failures do not say which store failed,
+   first one not known to have failed is blamed. */
+
+static memcached_request *get_failed_quiet(connection *conn, char *line)
+{
+    memcached_request *request = NULL;
+
+    if (protocol == PROTOCOL_META)
+    {
+        char *opaque = get_meta_flag(line, 'O');
+
+        if (opaque == NULL)
+        {
+            return NULL;
+        }
+
+        for (request = conn->pending; request != NULL && request->type == REQUEST_SET_QUIET; request = request->next)
+        {
+            if (request->opaque == atoi(opaque))
+            {
+                return request;
+            }
+        }
+
+        return NULL;
+    }
+
+    if (strncmp(line, "SERVER_ERROR", 12) != 0 && strncmp(line, "CLIENT_ERROR", 12) != 0 && strcmp(line, "ERROR") != 0)
+    {
+        return NULL;
+    }
+
+    for (request = conn->pending; request != NULL && request->type == REQUEST_SET_QUIET; request = request->next)
+    {
+        if (request->status == 1 || request->next == NULL || request->next->type != REQUEST_SET_QUIET)
+        {
+            return request;
+        }
+    }
+
+    return NULL;
+}
+
+/* Meta gets are quiet: only hits reply, with "VA <bytes> O<i>". Gets pending before the one whose O<i> is in
+   line missed and are completed. returns 0 if line is not value of any pending get, then it answers request
+   sent after them (internal "mn" at the latest), so all of them missed */
+
+static int complete_missed_gets(connection *conn, char *line)
+{
+    char *opaque = (strncmp(line, "VA ", 3) == 0) ? get_meta_flag(line, 'O') : NULL;
+    int hit = 0;
+
+    for (memcached_request *request = conn->pending; opaque != NULL && request != NULL && request->type == REQUEST_GET;
+         request = request->next)
+    {
+        if (request->opaque == atoi(opaque))
+        {
+            hit = 1;
+            break;
+        }
+    }
+
+    while (conn->pending != NULL && conn->pending->type == REQUEST_GET &&
+           !(hit && conn->pending->opaque == atoi(opaque)))
+    {
+        complete_head(conn, 0);
+    }
+
+    return hit;
+}
+
+/* ascii: VALUE responses come in order of keys in get command and missing keys are skipped, command ends
+   with END. meta: every mg of gets gets either "VA <bytes>" or "EN", quiet mg of get only its "VA". */
+
+static int parse_retrieval_line(connection *conn, char *line)
+{
+    memcached_request *request = conn->pending;
+    size_t bytes = 0;
+
+    if (protocol == PROTOCOL_META)
+    {
+        if (strcmp(line, "EN") == 0)
+        {
+            complete_head(conn, 0);
+            return 0;
+        }
+
+        if (strncmp(line, "VA ", 3) != 0 || sscanf(line + 3, "%zu", &bytes) != 1)
+        {
+            return -1;
+        }
+
+        char *cas = get_meta_flag(line, 'c');
+        request->cas = (cas != NULL) ? strtoull(cas, NULL, 10) : 0;
+
+        start_body(conn, bytes);
+        return 0;
+    }
+
+    if (strcmp(line, "END") == 0) // keys of command not returned so far are missing
+    {
+        int last = 0;
+
+        while (!last)
+        {
+            last = conn->pending->last_in_group;
+            complete_head(conn, 0);
+        }
+
+        return 0;
+    }
+
+    if (strncmp(line, "VALUE ", 6) != 0)
+    {
+        return -1;
+    }
+
+    char *key = line + 6;
+    char *key_end = strchr(key, ' ');
+
+    if (key_end == NULL)
+    {
+        return -1;
+    }
+    *key_end = '\0';
+
+    if (request->type == REQUEST_GETS)
+    {
+        if (sscanf(key_end + 1, "%*u %zu %llu", &bytes, &request->cas) != 2)
+        {
+            return -1;
+        }
+    }
+    else if (sscanf(key_end + 1, "%*u %zu", &bytes) != 1)
+    {
+        return -1;
+    }
+
+    while (strcmp(conn->pending->key, key) != 0)
+    {
+        if (conn->pending->last_in_group) // not requested
+        {
+            return -1;
+        }
+
+        complete_head(conn, 0);
+    }
+
+    start_body(conn, bytes);
+
+    return 0;
+}
+
+/* ascii: new value as a line or NOT_FOUND. meta: new value as "VA <bytes>" data block or NF */
+
+static int parse_incr_line(connection *conn, char *line)
+{
+    memcached_request *request = conn->pending;
+
+    if (strcmp(line, "NOT_FOUND") == 0 || strcmp(line, "NF") == 0)
+    {
+        complete_head(conn, 0);
+        return 0;
+    }
+
+    if (protocol == PROTOCOL_META)
+    {
+        size_t bytes = 0;
+
+        if (strncmp(line, "VA ", 3) != 0 || sscanf(line + 3, "%zu", &bytes) != 1)
+        {
+            return -1;
+        }
+
+        start_body(conn, bytes);
+        return 0;
+    }
+
+    if (line[0] < '0' || line[0] > '9')
+    {
+        complete_head(conn, -1);
+        return 0;
+    }
+
+    request->value = strdup(line);
+    request->count = strlen(line);
+    complete_head(conn, 1);
+
+    return 0;
+}
+
+/* status of store: 1 stored, 0 refused (key exists, is missing or was changed), -1 error (SERVER_ERROR for
+   too large item, out of memory, ...) */
+
+static int store_status(char *line)
+{
+    if (strcmp(line, "STORED") == 0 || strcmp(line, "HD") == 0)
+    {
+        return 1;
+    }
+
+    if (strcmp(line, "NOT_STORED") == 0 || strcmp(line, "EXISTS") == 0 || strcmp(line, "NOT_FOUND") == 0 ||
+        strcmp(line, "NS") == 0 || strcmp(line, "EX") == 0 || strcmp(line, "NF") == 0)
+    {
+        return 0;
+    }
+
+    return -1;
+}
+
+/* handles one response line for first pending request. returns -1 if line does not fit the request */
+
+static int parse_line(connection *conn, char *line)
+{
+    memcached_request *request = conn->pending;
+
+    if (conn->skip_end)
+    {
+        if (strcmp(line, "END") != 0)
+        {
+            return -1;
+        }
+
+        conn->skip_end = 0;
+        complete_head(conn, request->status);
+
+        return 0;
+    }
+
+    if (request->type == REQUEST_SET_QUIET)
+    {
+        memcached_request *failed = get_failed_quiet(conn, line);
+
+        if (failed != NULL)
+        {
+            printf("Set quiet: %s %s\n", line, failed->key);
+            failed->status = 0;
+            return 0;
+        }
+
+        // response to request sent after quiet stores, so server is done with all of them
+        while (conn->pending != NULL && conn->pending->type == REQUEST_SET_QUIET)
+        {
+            complete_head(conn, conn->pending->status);
+        }
+
+        request = conn->pending;
+
+        if (request == NULL)
+        {
+            return -1;
+        }
+    }
+
+    if (protocol == PROTOCOL_META && request->type == REQUEST_GET && !complete_missed_gets(conn, line))
+    {
+        request = conn->pending;
+
+        if (request == NULL)
+        {
+            return -1;
+        }
+    }
+
+    switch (request->type)
+    {
+    case REQUEST_GET:
+    case REQUEST_GETS:
+        return parse_retrieval_line(conn, line);
+    case REQUEST_SET:
+    case REQUEST_ADD:
+    case REQUEST_CAS:
+        complete_head(conn, store_status(line));
+        return 0;
+    case REQUEST_DELETE:
+        if (strcmp(line, "DELETED") == 0 || strcmp(line, "HD") == 0)
+        {
+            complete_head(conn, 1);
+        }
+        else if (strcmp(line, "NOT_FOUND") == 0 || strcmp(line, "NF") == 0)
+        {
+            complete_head(conn, 0);
+        }
+        else
+        {
+            complete_head(conn, -1);
+        }
+        return 0;
+    case REQUEST_INCR:
+        return parse_incr_line(conn, line);
+    case REQUEST_NOOP:
+        if (strcmp(line, "MN") != 0)
+        {
+            return -1;
+        }
+        complete_head(conn, 1);
+        return 0;
+    case REQUEST_FLUSH:
+        complete_head(conn, (strcmp(line, "OK") == 0) ? 1 : 0);
+        return 0;
+    }
+
+    return -1;
+}
+
+/* Completes every pending request whose response is already buffered. Nothing is consumed from a
+   response that did not arrive whole, except data blocks, which are copied out as they come.
+   returns -1 if response could not be parsed */
+
+static int parse_responses(connection *conn)
+{
+    while (1)
+    {
+        if (conn->body_request != NULL)
+        {
+            if (read_body(conn) == 0)
+            {
+                return 0;
+            }
+            continue;
+        }
+
+        if (conn->pending == NULL)
+        {
+            return (conn->rbuf_start == conn->rbuf_end) ? 0 : -1;
+        }
+
+        char line[MAX_COMMAND_SIZE];
+        size_t line_size = peek_line(conn, line);
+
+        if (line_size == 0)
+        {
+            return 0;
+        }
+
+        conn->rbuf_start += line_size;
+
+        if (parse_line(conn, line) == -1)
+        {
+            printf("Response: %s\n", line);
+            return -1;
+        }
+    }
+}
+
+/* closes socket of failed connection once no io_uring operation uses it. new socket is opened by reconnect
+   when connection is used again */
+
+static void reconnect_if_idle(connection *conn)
+{
+    if (!conn->failed || conn->sending || conn->receiving)
+    {
+        return;
+    }
+
+    if (conn->epoll_fd != -1)
+    {
+        epoll_ctl(conn->epoll_fd, EPOLL_CTL_DEL, conn->sfd, NULL);
+        conn->epoll_fd = -1;
+    }
+
+    if (conn->sfd != -1)
+    {
+        close(conn->sfd);
+        conn->sfd = -1;
+    }
+
+    conn->failed = 0;
+}
+
+/* opens socket of connection closed after failure, so server that was down is tried again by next request.
+   returns -1 if it is still not reachable */
+
+static int reconnect(connection *conn)
+{
+    if (conn->sfd == -1)
+    {
+        conn->sfd = open_socket(conn->server);
+    }
+
+    return (conn->sfd != -1) ? 0 : -1;
+}
+
+/* Completes all pending requests of connection with -1 and drops everything buffered on it. Socket is
+   shut down, so in-flight io_uring operations on it finish, and replaced when they did. */
+
+static void fail_connection(connection *conn)
+{
+    printf("connection failed: %s\n", conn->server->name);
+
+    conn->body_request = NULL;
+    conn->skip_end = 0;
+
+    while (conn->pending != NULL)
+    {
+        complete_head(conn, -1);
+    }
+
+    conn->rbuf_start = 0;
+    conn->rbuf_end = 0;
+    conn->wbuf_size = 0;
+    conn->wbuf_sent = 0;
+    conn->next_wbuf_size = 0;
+
+    if (conn->sfd != -1)
+    {
+        shutdown(conn->sfd, SHUT_RDWR);
+    }
+
+    conn->failed = 1;
+
+    reconnect_if_idle(conn);
+}
+
+/* moves commands encoded while previous send was in flight to send buffer. returns 0 if there is nothing to send */
+
+static int prepare_output(connection *conn)
+{
+    if (conn->wbuf_sent < conn->wbuf_size)
+    {
+        return 1;
+    }
+
+    conn->wbuf_size = 0;
+    conn->wbuf_sent = 0;
+
+    if (conn->next_wbuf_size == 0)
+    {
+        return 0;
+    }
+
+    char *buffer = conn->wbuf;
+    size_t capacity = conn->wbuf_capacity;
+
+    conn->wbuf = conn->next_wbuf;
+    conn->wbuf_capacity = conn->next_wbuf_capacity;
+    conn->wbuf_size = conn->next_wbuf_size;
+
+    conn->next_wbuf = buffer;
+    conn->next_wbuf_capacity = capacity;
+    conn->next_wbuf_size = 0;
+
+    return 1;
+}
+
+/* Where next received bytes go. When data block is being read, nothing is buffered and wanted part of
+   range is large, it is received straight into caller buffer. Otherwise into connection buffer. */
+
+static char *get_receive_target(connection *conn, size_t *size, int *direct)
+{
+    memcached_request *request = conn->body_request;
+
+    if (request != NULL && request->range != NULL && conn->rbuf_start == conn->rbuf_end)
+    {
+        value_range *range = request->range;
+        size_t bytes = conn->body_bytes - 2;
+        size_t end = (range->offset + range->size < bytes) ? range->offset + range->size : bytes;
+        size_t position = conn->body_position;
+
+        if (position >= range->offset && position < end && end - position >= DIRECT_READ_SIZE)
+        {
+            *size = end - position;
+            *direct = 1;
+
+            return range->dest + position - range->offset;
+        }
+    }
+
+    *direct = 0;
+
+    if (conn->rbuf_start == conn->rbuf_end)
+    {
+        conn->rbuf_start = 0;
+        conn->rbuf_end = 0;
+    }
+
+    if (conn->rbuf_end == conn->rbuf_capacity)
+    {
+        if (conn->rbuf_start > 0)
+        {
+            memmove(conn->rbuf, conn->rbuf + conn->rbuf_start, conn->rbuf_end - conn->rbuf_start);
+            conn->rbuf_end -= conn->rbuf_start;
+            conn->rbuf_start = 0;
+        }
+        else
+        {
+            conn->rbuf_capacity *= 2;
+            conn->rbuf = (char *)realloc(conn->rbuf, conn->rbuf_capacity);
+        }
+    }
+
+    *size = conn->rbuf_capacity - conn->rbuf_end;
+
+    return conn->rbuf + conn->rbuf_end;
+}
+
+static void on_received(connection *conn, size_t count, int direct)
+{
+    if (direct)
+    {
+        conn->body_position += count;
+    }
+    else
+    {
+        conn->rbuf_end += count;
+    }
+
+    if (parse_responses(conn) == -1)
+    {
+        fail_connection(conn);
+    }
+}
+
+static unsigned int get_ring_entries()
+{
+    unsigned int entries = URING_MIN_ENTRIES;
+
+    // every connection has at most one send and one recv in flight
+    while (entries < 2 * (unsigned int)num_servers)
+    {
+        entries *= 2;
+    }
+
+    return entries;
+}
+
+static void uring_destroy(uring *r)
+{
+    if (r->sqes != MAP_FAILED)
+    {
+        munmap(r->sqes, r->sqes_size);
+    }
+
+    if (r->cq_ring != MAP_FAILED && r->cq_ring != r->sq_ring)
+    {
+        munmap(r->cq_ring, r->cq_ring_size);
+    }
+
+    if (r->sq_ring != MAP_FAILED)
+    {
+        munmap(r->sq_ring, r->sq_ring_size);
+    }
+
+    close(r->fd);
+    free(r);
+}
+
+/* returns NULL if kernel does not support io_uring (or it is disabled) */
+
+static uring *uring_create(unsigned int entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int fd = syscall(__NR_io_uring_setup, entries, &params);
+
+    if (fd == -1)
+    {
+        return NULL;
+    }
+
+    uring *r = (uring *)calloc(1, sizeof(uring));
+
+    r->fd = fd;
+    r->entries = params.sq_entries;
+    r->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    r->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (r->cq_ring_size > r->sq_ring_size)
+        {
+            r->sq_ring_size = r->cq_ring_size;
+        }
+        r->cq_ring_size = r->sq_ring_size;
+    }
+
+    r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    r->cq_ring = r->sq_ring;
+
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        r->cq_ring =
+            mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    }
+
+    r->sqes = (struct io_uring_sqe *)mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                                          IORING_OFF_SQES);
+
+    if (r->sq_ring == MAP_FAILED || r->cq_ring == MAP_FAILED || r->sqes == MAP_FAILED)
+    {
+        uring_destroy(r);
+        return NULL;
+    }
+
+    char *sq = (char *)r->sq_ring;
+    char *cq = (char *)r->cq_ring;
+
+    r->sq_head = (unsigned int *)(sq + params.sq_off.head);
+    r->sq_tail = (unsigned int *)(sq + params.sq_off.tail);
+    r->sq_mask = (unsigned int *)(sq + params.sq_off.ring_mask);
+    r->sq_array = (unsigned int *)(sq + params.sq_off.array);
+
+    r->cq_head = (unsigned int *)(cq + params.cq_off.head);
+    r->cq_tail = (unsigned int *)(cq + params.cq_off.tail);
+    r->cq_mask = (unsigned int *)(cq + params.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    return r;
+}
+
+/* submits queued entries and waits until at least wait_for of them completed */
+
+static void uring_enter(uring *r, unsigned int wait_for)
+{
+    while (1)
+    {
+        int submitted = syscall(__NR_io_uring_enter, r->fd, r->to_submit, wait_for,
+                                (wait_for > 0) ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+
+        if (submitted >= 0)
+        {
+            r->to_submit -= submitted;
+            return;
+        }
+
+        if (errno != EINTR)
+        {
+            perror("io_uring_enter");
+            return;
+        }
+    }
+}
+
+static void uring_queue(uring *r, int opcode, int fd, char *buffer, size_t size, unsigned long long user_data)
+{
+    unsigned int tail = *r->sq_tail;
+
+    if (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) == r->entries) // full, kernel takes them all on enter
+    {
+        uring_enter(r, 0);
+    }
+
+    unsigned int index = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[index];
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long long)(uintptr_t)buffer;
+    sqe->len = size;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = user_data;
+
+    r->sq_array[index] = index;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    r->to_submit += 1;
+}
+
+/* user_data of entry is connection pointer, lowest bit set for recv */
+
+static void uring_start_io(uring *r, connection *conn)
+{
+    if (conn->failed)
+    {
+        return;
+    }
+
+    if (!conn->sending && prepare_output(conn))
+    {
+        uring_queue(r, IORING_OP_SEND, conn->sfd, conn->wbuf + conn->wbuf_sent, conn->wbuf_size - conn->wbuf_sent,
+                    (uintptr_t)conn);
+        conn->sending = 1;
+    }
+
+    if (!conn->receiving && conn->pending != NULL)
+    {
+        size_t size = 0;
+        char *target = get_receive_target(conn, &size, &conn->recv_direct);
+
+        uring_queue(r, IORING_OP_RECV, conn->sfd, target, size, (uintptr_t)conn | 1);
+        conn->receiving = 1;
+    }
+}
+
+static void uring_complete(connection *conn, int is_recv, int result)
+{
+    if (is_recv)
+    {
+        conn->receiving = 0;
+    }
+    else
+    {
+        conn->sending = 0;
+    }
+
+    if (conn->failed)
+    {
+        reconnect_if_idle(conn);
+        return;
+    }
+
+    if (result == -EINTR || result == -EAGAIN) // queued again by next uring_start_io
+    {
+        return;
+    }
+
+    if (result < 0 || (is_recv && result == 0))
+    {
+        fail_connection(conn);
+        return;
+    }
+
+    if (is_recv)
+    {
+        on_received(conn, result, conn->recv_direct);
+    }
+    else
+    {
+        conn->wbuf_sent += result;
+    }
+}
+
+static void uring_reap(uring *r)
+{
+    unsigned int head = *r->cq_head;
+
+    while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+    {
+        struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+        connection *conn = (connection *)(uintptr_t)(cqe->user_data & ~1ULL);
+
+        uring_complete(conn, cqe->user_data & 1, cqe->res);
+
+        head += 1;
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    }
+}
+
+/* sends and receives on non-blocking socket until it would block. returns 1 if anything happened */
+
+static int socket_io(connection *conn)
+{
+    int progress = 0;
+
+    while (prepare_output(conn))
+    {
+        ssize_t n = send(conn->sfd, conn->wbuf + conn->wbuf_sent, conn->wbuf_size - conn->wbuf_sent, MSG_NOSIGNAL);
+
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+
+            fail_connection(conn);
+            return 1;
+        }
+
+        conn->wbuf_sent += n;
+        progress = 1;
+    }
+
+    while (conn->pending != NULL)
+    {
+        size_t size = 0;
+        int direct = 0;
+        char *target = get_receive_target(conn, &size, &direct);
+
+        ssize_t n = recv(conn->sfd, target, size, 0);
+
+        if (n == -1 && errno == EINTR)
+            continue;
+
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+
+        if (n <= 0)
+        {
+            fail_connection(conn);
+            return 1;
+        }
+
+        on_received(conn, n, direct);
+        progress = 1;
+    }
+
+    return progress;
+}
+
+static void free_thread_engine(void *data)
+{
+    thread_engine *te = (thread_engine *)data;
+
+    if (te->ring != NULL)
+    {
+        uring_destroy(te->ring);
+    }
+
+    if (te->epoll_fd != -1)
+    {
+        close(te->epoll_fd);
+    }
+
+    for (int s = 0; s < num_servers; s++)
+    {
+        if (te->udp_sockets[s] != -1)
+        {
+            close(te->udp_sockets[s]);
+        }
+    }
+
+    free(te->udp_sockets);
+    free(te);
+}
+
+static void create_engine_key()
+{
+    pthread_key_create(&engine_key, free_thread_engine);
+}
+
+static thread_engine *get_thread_engine()
+{
+    pthread_once(&engine_key_once, create_engine_key);
+
+    thread_engine *te = (thread_engine *)pthread_getspecific(engine_key);
+
+    if (te != NULL)
+    {
+        return te;
+    }
+
+    te = (thread_engine *)malloc(sizeof(thread_engine));
+    te->ring = NULL;
+    te->epoll_fd = -1;
+    te->udp_sockets = (int *)malloc(num_servers * sizeof(int));
+    te->next_udp_id = 0;
+
+    for (int s = 0; s < num_servers; s++)
+    {
+        te->udp_sockets[s] = -1;
+    }
+
+    if (engine == ENGINE_URING)
+    {
+        te->ring = uring_create(get_ring_entries());
+    }
+
+    if (te->ring == NULL)
+    {
+        te->epoll_fd = epoll_create1(0);
+    }
+
+    pthread_setspecific(engine_key, te);
+
+    return te;
+}
+
+/* Moves I/O of all held connections forward: queues sends/recvs on io_uring and waits for at least one
+   completion, or with epoll sends/receives until sockets would block and waits for readiness only
+   if nothing could be done. */
+
+static void make_progress(memcached_async *ctx)
+{
+    thread_engine *te = get_thread_engine();
+
+    if (te->ring != NULL)
+    {
+        for (int s = 0; s < num_servers; s++)
+        {
+            if (ctx->conns[s] != NULL)
+            {
+                uring_start_io(te->ring, ctx->conns[s]);
+            }
+        }
+
+        uring_enter(te->ring, 1);
+        uring_reap(te->ring);
+
+        return;
+    }
+
+    int progress = 0;
+
+    for (int s = 0; s < num_servers; s++)
+    {
+        if (ctx->conns[s] != NULL)
+        {
+            progress |= socket_io(ctx->conns[s]);
+        }
+    }
+
+    if (progress)
+    {
+        return;
+    }
+
+    for (int s = 0; s < num_servers; s++)
+    {
+        connection *conn = ctx->conns[s];
+
+        if (conn != NULL && conn->epoll_fd != te->epoll_fd)
+        {
+            struct epoll_event event;
+            event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+            event.data.ptr = conn;
+
+            epoll_ctl(te->epoll_fd, EPOLL_CTL_ADD, conn->sfd, &event);
+            conn->epoll_fd = te->epoll_fd;
+        }
+    }
+
+    struct epoll_event events[EPOLL_MAX_EVENTS];
+    epoll_wait(te->epoll_fd, events, EPOLL_MAX_EVENTS, -1);
+}
+
+static int has_operations_in_flight(memcached_async *ctx)
+{
+    for (int s = 0; s < num_servers; s++)
+    {
+        connection *conn = ctx->conns[s];
+
+        if (conn != NULL && (conn->sending || conn->receiving || conn->failed))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void wait_for_all(memcached_async *ctx)
+{
+    while (ctx->in_flight > 0 || has_operations_in_flight(ctx))
+    {
+        make_progress(ctx);
+    }
+}
+
+static void hold_connection(memcached_async *ctx, int s, connection *conn)
+{
+    ctx->conns[s] = conn;
+    conn->owner = ctx;
+
+    if (s > ctx->max_held)
+    {
+        ctx->max_held = s;
+    }
+}
+
+static void release_all(memcached_async *ctx)
+{
+    for (int s = 0; s < num_servers; s++)
+    {
+        connection *conn = ctx->conns[s];
+
+        if (conn == NULL)
+            continue;
+
+        if (conn->epoll_fd != -1)
+        {
+            epoll_ctl(conn->epoll_fd, EPOLL_CTL_DEL, conn->sfd, NULL);
+            conn->epoll_fd = -1;
+        }
+
+        conn->owner = NULL;
+        release_connection(conn);
+        ctx->conns[s] = NULL;
+    }
+
+    ctx->max_held = -1;
+}
+
+/* Connections are acquired in server order, so threads can not deadlock waiting for each others connections.
+   Connection for server lower than one already held is only tried. If it is busy, context finishes its
+   requests in flight, gives back everything and acquires again in order. */
+
+static void acquire_connections(memcached_async *ctx)
+{
+    int needed[num_servers];
+    int lowest = num_servers;
+
+    memset(needed, 0, sizeof(needed));
+
+    for (memcached_request *request = ctx->queued; request != NULL; request = request->next)
+    {
+        if (ctx->conns[request->server] == NULL)
+        {
+            needed[request->server] = 1;
+
+            if (request->server < lowest)
+            {
+                lowest = request->server;
+            }
+        }
+    }
+
+    if (lowest < ctx->max_held)
+    {
+        int busy = 0;
+
+        for (int s = 0; s < num_servers && !busy; s++)
+        {
+            if (!needed[s] || ctx->conns[s] != NULL)
+                continue;
+
+            connection *conn = try_acquire_connection(&servers[s]);
+
+            if (conn == NULL)
+            {
+                busy = 1;
+            }
+            else
+            {
+                hold_connection(ctx, s, conn);
+            }
+        }
+
+        if (busy)
+        {
+            wait_for_all(ctx);
+            release_all(ctx);
+
+            for (memcached_request *request = ctx->queued; request != NULL; request = request->next)
+            {
+                needed[request->server] = 1;
+            }
+        }
+    }
+
+    for (int s = 0; s < num_servers; s++)
+    {
+        if (needed[s] && ctx->conns[s] == NULL)
+        {
+            hold_connection(ctx, s, acquire_connection(&servers[s]));
+        }
+    }
+}
+
+/* quiet requests reply only on failure (stores) or hit (meta gets) */
+
+static int is_quiet(memcached_request *request)
+{
+    return request->type == REQUEST_SET_QUIET || (protocol == PROTOCOL_META && request->type == REQUEST_GET);
+}
+
+/* encodes queued requests into connections of their servers. quiet requests at the end of connection
+   output get internal "mn", its reply tells they are done */
+
+static void flush_queued(memcached_async *ctx)
+{
+    if (ctx->queued == NULL)
+    {
+        return;
+    }
+
+    acquire_connections(ctx);
+
+    int num_queued = 0;
+
+    for (memcached_request *request = ctx->queued; request != NULL; request = request->next)
+    {
+        num_queued += 1;
+    }
+
+    memcached_request **queued = (memcached_request **)malloc(num_queued * sizeof(memcached_request *));
+    memcached_request **batch = (memcached_request **)malloc(num_queued * sizeof(memcached_request *));
+
+    int i = 0;
+    for (memcached_request *request = ctx->queued; request != NULL; request = request->next)
+    {
+        queued[i] = request;
+        i += 1;
+    }
+
+    ctx->queued = NULL;
+    ctx->queued_tail = NULL;
+    ctx->in_flight += num_queued;
+
+    for (int s = 0; s < num_servers; s++)
+    {
+        int count = 0;
+
+        for (i = 0; i < num_queued; i++)
+        {
+            if (queued[i]->server == s)
+            {
+                batch[count] = queued[i];
+                count += 1;
+            }
+        }
+
+        if (count == 0)
+            continue;
+
+        connection *conn = ctx->conns[s];
+        int connected = reconnect(conn) == 0;
+
+        for (int j = 0; j < count; j++)
+        {
+            encode_request(conn, batch[j], (j > 0) ? batch[j - 1] : NULL, (j + 1 < count) ? batch[j + 1] : NULL);
+        }
+
+        if (is_quiet(batch[count - 1]))
+        {
+            memcached_request *noop = (memcached_request *)calloc(1, sizeof(memcached_request));
+            noop->type = REQUEST_NOOP;
+            noop->internal = 1;
+
+            ctx->in_flight += 1;
+            encode_request(conn, noop, batch[count - 1], NULL);
+        }
+
+        if (!connected) // requests complete with -1
+        {
+            fail_connection(conn);
+        }
+    }
+
+    free(queued);
+    free(batch);
+}
+
+memcached_async *memcached_async_begin()
+{
+    memcached_async *ctx = (memcached_async *)calloc(1, sizeof(memcached_async));
+
+    ctx->conns = (connection **)calloc(num_servers, sizeof(connection *));
+    ctx->max_held = -1;
+
+    return ctx;
+}
+
+static void submit_to_server(memcached_async *ctx, memcached_request *request, int s)
+{
+    request->server = s;
+    request->status = -1;
+    request->internal = 0;
+    request->next = NULL;
+
+    if (is_retrieval(request))
+    {
+        if (request->range != NULL)
+        {
+            request->range->read = -1;
+        }
+        else
+        {
+            request->value = NULL;
+        }
+    }
+
+    if (ctx->queued_tail != NULL)
+    {
+        ctx->queued_tail->next = request;
+    }
+    else
+    {
+        ctx->queued = request;
+    }
+    ctx->queued_tail = request;
+}
+
+/* Queues request of caller. Nothing is sent until memcached_async_reap or memcached_async_end, so requests
+   submitted together go out together: one write per connection, responses of all servers awaited at once. */
+
+void memcached_async_submit(memcached_async *ctx, memcached_request *request)
+{
+    submit_to_server(ctx, request, get_server_index(request->key));
+}
+
+/* Sends submitted requests and waits until at least one request completes. Up to max completed requests
+   are stored to completed. returns their number, 0 if there is nothing left in flight */
+
+int memcached_async_reap(memcached_async *ctx, memcached_request **completed, int max)
+{
+    flush_queued(ctx);
+
+    while (ctx->completed == NULL && ctx->in_flight > 0)
+    {
+        make_progress(ctx);
+    }
+
+    int count = 0;
+
+    while (count < max && ctx->completed != NULL)
+    {
+        completed[count] = ctx->completed;
+        ctx->completed = ctx->completed->next;
+        completed[count]->next = NULL;
+        count += 1;
+    }
+
+    if (ctx->completed == NULL)
+    {
+        ctx->completed_tail = NULL;
+    }
+
+    return count;
+}
+
+/* completes all submitted requests (results are in requests, reaping them is not needed) and frees context */
+
+void memcached_async_end(memcached_async *ctx)
+{
+    flush_queued(ctx);
+    wait_for_all(ctx);
+    release_all(ctx);
+
+    free(ctx->conns);
+    free(ctx);
+}
+
+/* server spec: host[:port[:weight]] or /path/to/socket[:weight] */
+
+static void parse_server(server *srv, char *spec)
+{
+    char *copy = strdup(spec);
+
+    if (copy[0] == '/')
+    {
+        char *weight = strrchr(copy, ':');
+
+        if (weight != NULL && strspn(weight + 1, "0123456789") == strlen(weight + 1))
+        {
+            *weight = '\0';
+            weight += 1;
+        }
+        else
+        {
+            weight = NULL;
+        }
+
+        srv->socket_path = strdup(copy);
+        srv->name = strdup(copy);
+        srv->host = NULL;
+        srv->port = 0;
+        srv->weight = (weight != NULL) ? atoi(weight) : 1;
+
+        if (srv->weight < 1)
+        {
+            srv->weight = 1;
+        }
+
+        free(copy);
+        return;
+    }
+
+    char *port = strchr(copy, ':');
+    char *weight = NULL;
+
+    if (port != NULL)
+    {
+        *port = '\0';
+        port += 1;
+
+        weight = strchr(port, ':');
+
+        if (weight != NULL)
+        {
+            *weight = '\0';
+            weight += 1;
+        }
+    }
+
+    srv->socket_path = NULL;
+    srv->host = strdup(copy);
+    srv->port = (port != NULL) ? atoi(port) : PORT;
+    srv->weight = (weight != NULL) ? atoi(weight) : 1;
+
+    if (srv->weight < 1)
+    {
+        srv->weight = 1;
+    }
+
+    int name_size = snprintf(NULL, 0, "%s:%d", srv->host, srv->port);
+    srv->name = (char *)malloc(name_size + 1);
+    snprintf(srv->name, name_size + 1, "%s:%d", srv->host, srv->port);
+
+    free(copy);
+}
+
+static void init_connection(connection *conn, server *srv)
+{
+    memset(conn, 0, sizeof(connection));
+
+    conn->server = srv;
+    conn->sfd = open_socket(srv);
+    conn->epoll_fd = -1;
+
+    if (conn->sfd == -1) // server not reachable at mount
+    {
+        exit(errno);
+    }
+
+    conn->rbuf_capacity = READ_BUFFER_SIZE;
+    conn->rbuf = (char *)malloc(READ_BUFFER_SIZE);
+
+    conn->wbuf_capacity = WRITE_BUFFER_SIZE;
+    conn->wbuf = (char *)malloc(WRITE_BUFFER_SIZE);
+    conn->next_wbuf_capacity = WRITE_BUFFER_SIZE;
+    conn->next_wbuf = (char *)malloc(WRITE_BUFFER_SIZE);
+}
+
+/* Connects to every server in server_specs (127.0.0.1:11211 if there are none) and places them on hash ring.
+   Every server gets pool of pool_size connections. Every api call checks out one connection per server
+   it talks to, so up to pool_size fuse threads can talk to each server concurrently.
+   engine_type ENGINE_URING falls back to ENGINE_EPOLL when kernel does not support io_uring. */
+
+void memcached_connect(char **server_specs, int num_specs, int pool_size, int protocol_type, int engine_type)
+{
+    protocol = protocol_type;
+    engine = engine_type;
+
+    if (pool_size < 1)
+    {
+        pool_size = 1;
+    }
+
+    char *default_spec = "127.0.0.1";
+
+    if (num_specs == 0)
+    {
+        server_specs = &default_spec;
+        num_specs = 1;
+    }
+
+    if (engine == ENGINE_URING)
+    {
+        uring *probe = uring_create(URING_MIN_ENTRIES);
+
+        if (probe == NULL)
+        {
+            printf("io_uring not available, using epoll\n");
+            engine = ENGINE_EPOLL;
+        }
+        else
+        {
+            uring_destroy(probe);
+        }
+    }
+
+    servers = (server *)malloc(num_specs * sizeof(server));
+    num_servers = num_specs;
+
+    for (int s = 0; s < num_servers; s++)
+    {
+        server *srv = &servers[s];
+
+        parse_server(srv, server_specs[s]);
+
+        pthread_mutex_init(&srv->pool_lock, NULL);
+        pthread_cond_init(&srv->pool_cond, NULL);
+
+        srv->connections = (connection *)malloc(pool_size * sizeof(connection));
+        srv->free_connections = NULL;
+        srv->num_connections = pool_size;
+
+        for (int i = 0; i < pool_size; i++)
+        {
+            init_connection(&srv->connections[i], srv);
+            release_connection(&srv->connections[i]);
+        }
+
+        printf("connection established: %s weight %d (%d connections, %s protocol, %s)\n", srv->name, srv->weight,
+               pool_size, (protocol == PROTOCOL_META) ? "meta" : "ascii", (engine == ENGINE_URING) ? "io_uring" : "epoll");
+    }
+
+    build_ring();
+}
+
+void memcached_disconnect()
+{
+    for (int s = 0; s < num_servers; s++)
+    {
+        server *srv = &servers[s];
+
+        pthread_mutex_lock(&srv->pool_lock);
+
+        for (int i = 0; i < srv->num_connections; i++)
+        {
+            close(srv->connections[i].sfd);
+            free(srv->connections[i].rbuf);
+            free(srv->connections[i].wbuf);
+            free(srv->connections[i].next_wbuf);
+        }
+
+        free(srv->connections);
+        free(srv->name);
+        free(srv->host);
+        free(srv->socket_path);
+
+        pthread_mutex_unlock(&srv->pool_lock);
+    }
+
+    free(servers);
+    free(ring);
+
+    servers = NULL;
+    num_servers = 0;
+    ring = NULL;
+    num_points = 0;
+}
+
+static void init_request(memcached_request *request, int type, char *key, char *value, size_t count)
+{
+    memset(request, 0, sizeof(memcached_request));
+
+    request->type = type;
+    request->key = key;
+    request->value = value;
+    request->count = count;
+}
+
+/* Synchronous api is built on the engine: all requests of a call are submitted at once and
+   completed together, with one write per connection and all servers working at the same time. */
+
+static void run_requests(memcached_request *requests, int num_requests)
+{
+    memcached_async *ctx = memcached_async_begin();
+
+    for (int i = 0; i < num_requests; i++)
+    {
+        memcached_async_submit(ctx, &requests[i]);
+    }
+
+    memcached_async_end(ctx);
+}
+
+/* Set new value to new or existing key. */
+
+int memcached_set(char *key, char *value, size_t count)
+{
+    memcached_request request;
+    init_request(&request, REQUEST_SET, key, value, count);
 
-    memcpy(command + index, command_name, command_size);
-    index += command_size;
-    memcpy(command + index, " ", 1);
-    index += 1;
-    memcpy(command + index, key, key_size);
-    index += key_size;
-    memcpy(command + index, " 0 0 ", 5);
-    index += 5;
-    memcpy(command + index, bytes, strlen(bytes));
-    index += strlen(bytes);
-    memcpy(command + index, "\n", 1);
-    index += 1;
-    memcpy(command + index, value, *count);
-    index += *count;
-    memcpy(command + index, "\r\n", 2);
-    index += 2;
+    run_requests(&request, 1);
 
-    command[index] = '\0';
+    if (request.status == 1)
+    {
+        printf("Set: stored\n");
+        return 1;
+    }
 
-    *count = index;
+    printf("Set: error\n");
 
-    free(bytes);
-    return command;
+    return 0;
 }
 
-static char *get_retrieve_command(char *command_name, char *key, size_t *count)
+/* Set a value to a new key. If the key already exists, then it gives the output NOT_STORED.
+   returns 1 if stored, 0 if key exists, -1 on error */
+
+int memcached_add(char *key, char *value, size_t count)
 {
-    size_t command_size = strlen(command_name);
+    memcached_request request;
+    init_request(&request, REQUEST_ADD, key, value, count);
 
-    size_t key_size = strlen(key);
+    run_requests(&request, 1);
 
-    char *tail = "\r\n";
-    size_t tail_size = strlen(tail);
+    if (request.status == 1)
+    {
+        printf("Add: stored\n");
+        return 1;
+    }
 
-    char *command = (char *)malloc(command_size + 1 + key_size + tail_size + 1);
-    int index = 0;
-    memcpy(command + index, command_name, command_size);
-    index += command_size;
-    memcpy(command + index, " ", 1);
-    index += 1;
-    memcpy(command + index, key, key_size);
-    index += key_size;
-    memcpy(command + index, tail, tail_size);
-    index += tail_size;
-    command[index] = '\0';
+    if (request.status == -1)
+    {
+        printf("Add: error\n");
+        return -1;
+    }
 
-    *count = index;
+    printf("Add: not stored\n");
 
-    return command;
+    return 0;
 }
 
-static char *send_to_server(char *command, int write_count)
+/* Gets keys from their servers. Found values are either malloc-ed into values[i] (with their sizes in counts[i]
+   if counts is not NULL) or read into ranges[i] (one of values/ranges is NULL). Consecutive ascii gets for one server are joined into one
+   "get k1 k2 ... kN" command. returns number of found keys or -1 on error */
+
+static int get_values(char **keys, int num_keys, char **values, size_t *counts, value_range *ranges)
 {
-    size_t bytes_writen = write(sfd, command, write_count);
+    memcached_request *requests = (memcached_request *)malloc(num_keys * sizeof(memcached_request));
 
-    if (bytes_writen == -1)
+    for (int i = 0; i < num_keys; i++)
     {
-        perror(NULL);
+        init_request(&requests[i], REQUEST_GET, keys[i], NULL, 0);
+        requests[i].range = (ranges != NULL) ? &ranges[i] : NULL;
+    }
+
+    run_requests(requests, num_keys);
+
+    int found = 0;
+
+    for (int i = 0; i < num_keys; i++)
+    {
+        if (values != NULL)
+        {
+            values[i] = requests[i].value;
+        }
+
+        if (counts != NULL)
+        {
+            counts[i] = (requests[i].value != NULL) ? requests[i].count : 0;
+        }
+
+        if (requests[i].status == -1)
+        {
+            found = -1;
+        }
+        else if (requests[i].status == 1 && found != -1)
+        {
+            found += 1;
+        }
+    }
+
+    if (found == -1)
+    {
+        for (int i = 0; i < num_keys && values != NULL; i++)
+        {
+            free(values[i]);
+            values[i] = NULL;
+        }
     }
 
-    char *response = (char *)malloc(MAX_COMMAND_SIZE);
-    size_t response_size = read(sfd, response, MAX_COMMAND_SIZE);
-    response[response_size] = '\0';
+    free(requests);
 
-    return response;
+    return found;
 }
 
-static char *send_command(char *command_name, char *key, char *value, size_t count)
+/* returened data needs to be freed when not needed anymore */
+
+char *memcached_get(char *key)
 {
-    char *command = NULL;
-    if (strcmp(value, "NOVALUE") == 0)
+    char *data = NULL;
+
+    if (get_values(&key, 1, &data, NULL, NULL) != 1)
     {
-        command = get_retrieve_command(command_name, key, &count);
+        printf("Get: end\n");
+        return NULL;
     }
-    else
+
+    return data;
+}
+
+/* same as memcached_get, count is set to size of value (binary values may contain null bytes) */
+
+char *memcached_get_sized(char *key, size_t *count)
+{
+    memcached_request request;
+    init_request(&request, REQUEST_GET, key, NULL, 0);
+
+    run_requests(&request, 1);
+
+    if (request.status != 1)
     {
-        command = get_storage_command(command_name, key, value, &count);
+        return NULL;
     }
 
-    char *response = send_to_server(command, count);
-    free(command);
+    *count = request.count;
 
-    return response;
+    return request.value;
 }
 
-void memcached_connect()
+/* Gets values for all keys with one request per server. values[i] is set to NULL if keys[i]
+   is not stored. returned values need to be freed. returns number of found keys or -1 on error */
+
+int memcached_get_multi(char **keys, int num_keys, char **values)
 {
-    struct sockaddr_in addr;
-    sfd = socket(AF_INET, SOCK_STREAM, 0);
+    return get_values(keys, num_keys, values, NULL, NULL);
+}
 
-    if (sfd == -1)
+/* same as memcached_get_multi, counts[i] is set to size of values[i] (binary values may contain null bytes) */
+
+int memcached_get_multi_sized(char **keys, int num_keys, char **values, size_t *counts)
+{
+    return get_values(keys, num_keys, values, counts, NULL);
+}
+
+/* one udp "get k1 k2 ... kN" for keys[batch[0..count)], response may come in several datagrams */
+typedef struct udp_request
+{
+    int server;
+    unsigned short id;
+    char *command; /* frame header followed by command */
+    size_t command_size;
+    int *batch;
+    int count;
+    char *datagrams[UDP_MAX_DATAGRAMS]; /* payloads by sequence number, NULL until received */
+    size_t datagram_sizes[UDP_MAX_DATAGRAMS];
+    int total;    /* datagrams in response, 0 until first one is received */
+    int received;
+    int attempts;
+    int status; /* 0 - waiting, 1 - done, -1 - given up, keys go over tcp */
+} udp_request;
+
+/* frame header: request id, sequence number, total number of datagrams, reserved (all 16 bit, network order) */
+
+static void write_udp_header(char *header, unsigned short id, unsigned short sequence, unsigned short total)
+{
+    unsigned short fields[4] = {htons(id), htons(sequence), htons(total), 0};
+
+    memcpy(header, fields, UDP_HEADER_SIZE);
+}
+
+static void copy_range(value_range *range, char *data, size_t bytes)
+{
+    size_t end = (range->offset + range->size < bytes) ? range->offset + range->size : bytes;
+
+    if (end > range->offset)
     {
-        perror(NULL);
-        exit(errno);
+        memcpy(range->dest, data + range->offset, end - range->offset);
     }
 
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(PORT);
+    range->read = (end > range->offset) ? end - range->offset : 0;
+}
 
-    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+/* Joins datagrams of response and reads VALUE blocks into ranges. returns -1 if response is malformed */
 
-    int connection_status = connect(sfd, (struct sockaddr *)&addr, sizeof(struct sockaddr_in));
+static int parse_udp_response(udp_request *request, char **keys, value_range *ranges)
+{
+    size_t size = 0;
 
-    if (connection_status == -1)
+    for (int i = 0; i < request->total; i++)
     {
-        perror(NULL);
-        exit(errno);
+        size += request->datagram_sizes[i];
+    }
+
+    char *response = (char *)malloc(size + 1);
+    size_t position = 0;
+
+    for (int i = 0; i < request->total; i++)
+    {
+        memcpy(response + position, request->datagrams[i], request->datagram_sizes[i]);
+        position += request->datagram_sizes[i];
     }
+    response[size] = '\0';
+
+    int j = 0;
+    int status = -1;
 
-    if (connection_status == 0)
+    position = 0;
+
+    while (position < size)
     {
-        printf("connection established\n");
+        char *line = response + position;
+        char *line_end = strstr(line, "\r\n");
+
+        if (line_end == NULL)
+            break;
+
+        *line_end = '\0';
+        position = line_end + 2 - response;
+
+        if (strcmp(line, "END") == 0)
+        {
+            status = 0;
+            break;
+        }
+
+        char *key_end = (strncmp(line, "VALUE ", 6) == 0) ? strchr(line + 6, ' ') : NULL;
+        size_t bytes = 0;
+
+        if (key_end == NULL || sscanf(key_end, " %*u %zu", &bytes) != 1 || position + bytes + 2 > size)
+            break;
+
+        *key_end = '\0';
+
+        while (j < request->count && strcmp(keys[request->batch[j]], line + 6) != 0)
+        {
+            j += 1;
+        }
+
+        if (j == request->count)
+            break;
+
+        copy_range(&ranges[request->batch[j]], response + position, bytes);
+
+        j += 1;
+        position += bytes + 2;
     }
+
+    free(response);
+
+    return status;
 }
 
-/* Set new value to new or existing key. */
+static void receive_datagram(udp_request *requests, int num_requests, int s, char **keys, value_range *ranges,
+                             char *datagram, size_t size)
+{
+    if (size < UDP_HEADER_SIZE)
+        return;
 
-int memcached_set(char *key, char *value, size_t count)
+    unsigned short fields[4];
+    memcpy(fields, datagram, UDP_HEADER_SIZE);
+
+    unsigned short id = ntohs(fields[0]);
+    int sequence = ntohs(fields[1]);
+    int total = ntohs(fields[2]);
+
+    for (int r = 0; r < num_requests; r++)
+    {
+        udp_request *request = &requests[r];
+
+        if (request->server != s || request->id != id || request->status != 0)
+            continue;
+
+        if (total == 0 || total > UDP_MAX_DATAGRAMS || (request->total != 0 && total != request->total))
+        {
+            request->status = -1; // too large for udp
+            return;
+        }
+
+        request->total = total;
+
+        if (sequence >= total || request->datagrams[sequence] != NULL)
+            return;
+
+        request->datagrams[sequence] = (char *)malloc(size - UDP_HEADER_SIZE);
+        request->datagram_sizes[sequence] = size - UDP_HEADER_SIZE;
+        memcpy(request->datagrams[sequence], datagram + UDP_HEADER_SIZE, size - UDP_HEADER_SIZE);
+        request->received += 1;
+
+        if (request->received == total)
+        {
+            request->status = (parse_udp_response(request, keys, ranges) == -1) ? -1 : 1;
+        }
+
+        return;
+    }
+}
+
+static void send_udp_request(thread_engine *te, udp_request *request)
 {
-    char *response = send_command("set", key, value, count);
+    request->attempts += 1;
 
-    if (strcmp(response, "STORED\r\n") == 0)
+    if (send(te->udp_sockets[request->server], request->command, request->command_size, 0) == -1)
     {
-        printf("Set: stored\n");
-        free(response);
-        return 1;
+        request->status = -1;
     }
+}
 
-    printf("Set: error\n");
-    free(response);
+/* Gets block keys over udp: keys of every server are packed into as few get commands as fit in one
+   datagram (with responses expected to fit in UDP_MAX_DATAGRAMS), all of them are sent at once and responses are collected until UDP_TIMEOUT_MS passes without
+   any, then unanswered requests are sent again (up to UDP_RETRIES times). Keys that udp can not be used
+   for (unix socket server, range larger than UDP_MAX_VALUE_SIZE, response over UDP_MAX_DATAGRAMS) or whose
+   requests were not answered get over_tcp[i] = 1. Found keys get ranges[i].read set. */
 
-    return 0;
+static void get_ranges_udp(char **keys, int num_keys, value_range *ranges, int *over_tcp)
+{
+    thread_engine *te = get_thread_engine();
+
+    udp_request *requests = (udp_request *)calloc(num_keys, sizeof(udp_request));
+    int *batch = (int *)malloc(num_keys * sizeof(int));
+    int *server_of_key = (int *)malloc(num_keys * sizeof(int));
+    int num_requests = 0;
+    int batched = 0;
+
+    for (int i = 0; i < num_keys; i++)
+    {
+        server_of_key[i] = get_server_index(keys[i]);
+        over_tcp[i] = 1;
+
+        server *srv = &servers[server_of_key[i]];
+
+        if (srv->socket_path != NULL || ranges[i].size > UDP_MAX_VALUE_SIZE)
+            continue;
+
+        if (te->udp_sockets[server_of_key[i]] == -1)
+        {
+            te->udp_sockets[server_of_key[i]] = open_udp_socket(srv);
+        }
+
+        if (te->udp_sockets[server_of_key[i]] != -1)
+        {
+            over_tcp[i] = 0;
+        }
+    }
+
+    for (int s = 0; s < num_servers; s++)
+    {
+        udp_request *request = NULL;
+        size_t expected_size = 0; // response of request must fit in UDP_MAX_DATAGRAMS
+
+        for (int i = 0; i < num_keys; i++)
+        {
+            if (server_of_key[i] != s || over_tcp[i])
+                continue;
+
+            size_t key_size = strlen(keys[i]);
+            size_t response_size = UDP_VALUE_LINE_SIZE + key_size + ranges[i].offset + ranges[i].size;
+
+            if (request != NULL && (request->command_size + 1 + key_size + 2 > UDP_MAX_PAYLOAD ||
+                                    expected_size + response_size > UDP_MAX_DATAGRAMS * UDP_MAX_PAYLOAD))
+            {
+                request = NULL;
+            }
+
+            if (request == NULL)
+            {
+                request = &requests[num_requests];
+                num_requests += 1;
+
+                request->server = s;
+                request->id = te->next_udp_id;
+                request->command = (char *)malloc(UDP_MAX_PAYLOAD);
+                request->batch = batch + batched;
+
+                te->next_udp_id += 1;
+
+                write_udp_header(request->command, request->id, 0, 1);
+                memcpy(request->command + UDP_HEADER_SIZE, "get", 3);
+                request->command_size = UDP_HEADER_SIZE + 3;
+                expected_size = 0;
+            }
+
+            expected_size += response_size;
+
+            request->command[request->command_size] = ' ';
+            memcpy(request->command + request->command_size + 1, keys[i], key_size);
+            request->command_size += 1 + key_size;
+
+            request->batch[request->count] = i;
+            request->count += 1;
+            batched += 1;
+        }
+    }
+
+    for (int r = 0; r < num_requests; r++)
+    {
+        memcpy(requests[r].command + requests[r].command_size, "\r\n", 2);
+        requests[r].command_size += 2;
+
+        send_udp_request(te, &requests[r]);
+    }
+
+    char *datagram = (char *)malloc(UDP_MAX_DATAGRAM_SIZE);
+    struct pollfd fds[num_servers];
+
+    while (1)
+    {
+        int num_fds = 0;
+
+        for (int s = 0; s < num_servers; s++)
+        {
+            int waiting = 0;
+
+            for (int r = 0; r < num_requests && !waiting; r++)
+            {
+                waiting = (requests[r].server == s && requests[r].status == 0);
+            }
+
+            if (waiting)
+            {
+                fds[num_fds].fd = te->udp_sockets[s];
+                fds[num_fds].events = POLLIN;
+                num_fds += 1;
+            }
+        }
+
+        if (num_fds == 0)
+            break;
+
+        int ready = poll(fds, num_fds, UDP_TIMEOUT_MS);
+
+        if (ready == -1 && errno == EINTR)
+            continue;
+
+        if (ready <= 0) // timed out, answers (or requests) were lost
+        {
+            for (int r = 0; r < num_requests; r++)
+            {
+                if (requests[r].status != 0)
+                    continue;
+
+                if (requests[r].attempts > UDP_RETRIES)
+                {
+                    requests[r].status = -1;
+                }
+                else
+                {
+                    send_udp_request(te, &requests[r]);
+                }
+            }
+            continue;
+        }
+
+        for (int f = 0; f < num_fds; f++)
+        {
+            if (!(fds[f].revents & POLLIN))
+                continue;
+
+            int s = 0;
+            while (te->udp_sockets[s] != fds[f].fd)
+            {
+                s += 1;
+            }
+
+            ssize_t n = 0;
+
+            while ((n = recv(fds[f].fd, datagram, UDP_MAX_DATAGRAM_SIZE, MSG_DONTWAIT)) > 0)
+            {
+                receive_datagram(requests, num_requests, s, keys, ranges, datagram, n);
+            }
+        }
+    }
+
+    for (int r = 0; r < num_requests; r++)
+    {
+        udp_request *request = &requests[r];
+
+        if (request->status == -1)
+        {
+            for (int j = 0; j < request->count; j++)
+            {
+                over_tcp[request->batch[j]] = 1;
+                ranges[request->batch[j]].read = -1;
+            }
+        }
+
+        for (int d = 0; d < UDP_MAX_DATAGRAMS; d++)
+        {
+            free(request->datagrams[d]);
+        }
+
+        free(request->command);
+    }
+
+    free(datagram);
+    free(requests);
+    free(batch);
+    free(server_of_key);
 }
 
-/* Set a value to a new key. If the key already exists, then it gives the output NOT_STORED. */
+/* Same as memcached_get_multi, but without allocations: part of each value described by ranges[i]
+   is read from socket straight into ranges[i].dest. With udp enabled keys go over udp first and only
+   the rest over tcp. returns number of found keys or -1 on error */
 
-int memcached_add(char *key, char *value, size_t count)
+int memcached_get_ranges(char **keys, int num_keys, value_range *ranges)
 {
-    char *response = send_command("add", key, value, count);
+    if (!udp_enabled)
+    {
+        return get_values(keys, num_keys, NULL, NULL, ranges);
+    }
 
-    if (strcmp(response, "STORED\r\n") == 0)
+    for (int i = 0; i < num_keys; i++)
     {
-        printf("Add: stored\n");
-        free(response);
+        ranges[i].read = -1;
+    }
 
-        return 1;
+    int *over_tcp = (int *)malloc(num_keys * sizeof(int));
+    get_ranges_udp(keys, num_keys, ranges, over_tcp);
+
+    char **tcp_keys = (char **)malloc(num_keys * sizeof(char *));
+    value_range *tcp_ranges = (value_range *)malloc(num_keys * sizeof(value_range));
+    int num_tcp = 0;
+    int found = 0;
+
+    for (int i = 0; i < num_keys; i++)
+    {
+        if (over_tcp[i])
+        {
+            tcp_keys[num_tcp] = keys[i];
+            tcp_ranges[num_tcp] = ranges[i];
+            num_tcp += 1;
+        }
+        else if (ranges[i].read != -1)
+        {
+            found += 1;
+        }
     }
 
-    printf("Add: not stored\n");
-    free(response);
+    if (num_tcp > 0)
+    {
+        int tcp_found = get_values(tcp_keys, num_tcp, NULL, NULL, tcp_ranges);
 
-    return 0;
+        found = (tcp_found == -1) ? -1 : found + tcp_found;
+
+        for (int i = 0, t = 0; i < num_keys; i++)
+        {
+            if (over_tcp[i])
+            {
+                ranges[i].read = tcp_ranges[t].read;
+                t += 1;
+            }
+        }
+    }
+
+    free(over_tcp);
+    free(tcp_keys);
+    free(tcp_ranges);
+
+    return found;
 }
 
-/* returened data needs to be freed when not needed anymore */
+/* block gets go over udp from now on */
 
-char *memcached_get(char *key)
+void memcached_enable_udp()
 {
-    char *response = send_command("get", key, "NOVALUE", 0);
+    udp_enabled = 1;
+    printf("udp enabled for block reads\n");
+}
+
+/* Stores all values with "set <key> 0 0 <bytes> noreply" commands written back to back, without waiting
+   for replies. "mn" (no-op) is sent after the last one and its "MN" reply is the only synchronization point.
+   Server replies only for failed stores, everything read before "MN" is counted as error.
+   With meta protocol quiet "ms <key> <bytes> b q O<i>" is used, failures then carry token of failed item.
+   returns number of failed stores or -1 if connection failed */
+
+int memcached_set_multi(char **keys, char **values, size_t *counts, int num_items)
+{
+    memcached_request *requests = (memcached_request *)malloc(num_items * sizeof(memcached_request));
 
-    if (strcmp(response, "END\r\n") == 0)
+    for (int i = 0; i < num_items; i++)
     {
-        printf("Get: end\n");
-        free(response);
-        return NULL;
+        init_request(&requests[i], REQUEST_SET_QUIET, keys[i], values[i], counts[i]);
     }
 
-    size_t offset = strlen("VALUE") + strlen(key) + 1 + 3; // 3 space
+    run_requests(requests, num_items);
 
-    char data_size[MAX_COMMAND_SIZE];
-    int index = 0;
+    int failed = 0;
+
+    for (int i = 0; i < num_items; i++)
+    {
+        if (requests[i].status == -1)
+        {
+            failed = -1;
+        }
+        else if (requests[i].status == 0 && failed != -1)
+        {
+            failed += 1;
+        }
+    }
 
-    char cur = response[offset];
-    while (cur != '\n')
+    free(requests);
+
+    if (failed != 0)
     {
-        data_size[index] = cur;
-        index += 1;
-        cur = response[offset + index];
+        printf("Set multi: %d of %d not stored\n", failed, num_items);
     }
 
-    data_size[index] = '\0';
-    char *response_data = response + offset + index + 1; // \n
+    return failed;
+}
+
+/* Gets value together with its cas unique. returned data needs to be freed */
 
-    char *data = (char *)malloc(atoi(data_size) + 1);
-    memcpy(data, response_data, atoi(data_size));
-    data[atoi(data_size)] = '\0';
+char *memcached_gets(char *key, unsigned long long *cas)
+{
+    memcached_request request;
+    init_request(&request, REQUEST_GETS, key, NULL, 0);
 
-    free(response);
+    run_requests(&request, 1);
 
-    return data;
+    if (request.status != 1)
+    {
+        return NULL;
+    }
+
+    *cas = request.cas;
+
+    return request.value;
+}
+
+/* Stores value only if key was not changed since memcached_gets returned cas.
+   returns 1 if stored, 0 if value was changed or deleted in meantime, -1 on error */
+
+int memcached_cas(char *key, char *value, size_t count, unsigned long long cas)
+{
+    memcached_request request;
+    init_request(&request, REQUEST_CAS, key, value, count);
+    request.cas = cas;
+
+    run_requests(&request, 1);
+
+    if (request.status == 1)
+    {
+        return 1;
+    }
+
+    if (request.status == -1)
+    {
+        printf("Cas: error\n");
+        return -1;
+    }
+
+    printf("Cas: not stored\n");
+
+    return 0;
 }
 
 int memcached_delete(char *key)
 {
-    char *response = send_command("delete", key, "NOVALUE", 0);
+    memcached_request request;
+    init_request(&request, REQUEST_DELETE, key, NULL, 0);
+
+    run_requests(&request, 1);
 
-    if (strcmp(response, "DELETED\r\n") == 0)
+    if (request.status == 1)
     {
         printf("Delete: deleted\n");
-        free(response);
         return 0;
     }
 
-    if (strcmp(response, "ERROR\r\n") == 0)
+    if (request.status == -1)
     {
         printf("Delete: error\n");
-        free(response);
         return -1;
     }
 
     printf("Delete: not found\n");
-    free(response);
     return 0;
 }
 
+/* Deletes all keys with pipelined requests, in one round trip. returns -1 if connection failed, 0 otherwise
+   (missing keys are not error) */
+
+int memcached_delete_multi(char **keys, int num_keys)
+{
+    memcached_request *requests = (memcached_request *)malloc(num_keys * sizeof(memcached_request));
+
+    for (int i = 0; i < num_keys; i++)
+    {
+        init_request(&requests[i], REQUEST_DELETE, keys[i], NULL, 0);
+    }
+
+    run_requests(requests, num_keys);
+
+    int failed = 0;
+
+    for (int i = 0; i < num_keys; i++)
+    {
+        if (requests[i].status == -1)
+        {
+            failed = -1;
+        }
+    }
+
+    free(requests);
+
+    return failed;
+}
+
+/* Atomically adds delta to decimal number stored in key, *value is set to the result.
+   returns 1 on success, 0 if key does not exist, -1 on error */
+
+int memcached_incr(char *key, unsigned long long delta, unsigned long long *value)
+{
+    memcached_request request;
+    init_request(&request, REQUEST_INCR, key, NULL, delta);
+
+    run_requests(&request, 1);
+
+    if (request.status != 1)
+    {
+        printf("Incr: %s\n", (request.status == 0) ? "not found" : "error");
+        return request.status;
+    }
+
+    *value = strtoull(request.value, NULL, 10);
+    free(request.value);
+
+    return 1;
+}
+
+/* flushes all servers */
+
 int memcached_flush_all()
 {
-    char *command = "flush_all\r\n";
+    memcached_request requests[num_servers];
+    memcached_async *ctx = memcached_async_begin();
 
-    char *response = send_to_server(command, strlen(command));
+    for (int s = 0; s < num_servers; s++)
+    {
+        init_request(&requests[s], REQUEST_FLUSH, NULL, NULL, 0);
+        submit_to_server(ctx, &requests[s], s);
+    }
 
-    if (strcmp(response, "OK\r\n") == 0)
+    memcached_async_end(ctx);
+
+    for (int s = 0; s < num_servers; s++)
     {
-        printf("Flush all: ok\n");
-        free(response);
-        return 0;
+        if (requests[s].status != 1)
+        {
+            printf("Flush all: failed\n");
+            return -1;
+        }
     }
 
-    printf("Flush all: failed\n");
-    free(response);
+    printf("Flush all: ok\n");
 
-    return -1;
-}
\ No newline at end of file
+    return 0;
+}
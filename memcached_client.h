@@ -1,7 +1,73 @@
-void memcached_connect();
+#define PROTOCOL_ASCII 0
+#define PROTOCOL_META 1
+
+#define ENGINE_URING 0
+#define ENGINE_EPOLL 1
+
+#define REQUEST_GET 0
+#define REQUEST_GETS 1
+#define REQUEST_SET 2
+#define REQUEST_ADD 3
+#define REQUEST_CAS 4
+#define REQUEST_SET_QUIET 5
+#define REQUEST_DELETE 6
+#define REQUEST_NOOP 7
+#define REQUEST_FLUSH 8
+#define REQUEST_INCR 9
+
+/* part [offset, offset + size) of value is read into dest. read is number of bytes copied, -1 if key is missing */
+typedef struct value_range
+{
+    char *dest;
+    size_t offset;
+    size_t size;
+    ssize_t read;
+} value_range;
+
+/* One operation for the async engine. Caller sets type, key, value and count (stores), range (gets, optional),
+   cas (cas) and count (delta of incr). After completion status is 1 if found/stored/deleted, 0 if missing/not
+   stored and -1 if connection failed. Gets without range and incr return malloc-ed value and its count,
+   gets return cas. */
+typedef struct memcached_request
+{
+    int type;
+    char *key;
+    char *value;
+    size_t count;
+    value_range *range;
+    unsigned long long cas;
+    int status;
+
+    /* used by engine */
+    int server;
+    int opaque;
+    int last_in_group;
+    int internal;
+    struct memcached_request *next;
+} memcached_request;
+
+typedef struct memcached_async memcached_async;
+
+memcached_async *memcached_async_begin();
+void memcached_async_submit(memcached_async *ctx, memcached_request *request);
+int memcached_async_reap(memcached_async *ctx, memcached_request **completed, int max);
+void memcached_async_end(memcached_async *ctx);
+
+void memcached_connect(char **server_specs, int num_specs, int pool_size, int protocol_type, int engine_type);
+void memcached_disconnect();
+void memcached_enable_udp();
 int memcached_set(char *key, char *value, size_t count);
+int memcached_set_multi(char **keys, char **values, size_t *counts, int num_items);
 int memcached_add(char *key, char *value, size_t count);
 char *memcached_get(char *key);
+char *memcached_get_sized(char *key, size_t *count);
+int memcached_get_multi(char **keys, int num_keys, char **values);
+int memcached_get_multi_sized(char **keys, int num_keys, char **values, size_t *counts);
+int memcached_get_ranges(char **keys, int num_keys, value_range *ranges);
+char *memcached_gets(char *key, unsigned long long *cas);
+int memcached_cas(char *key, char *value, size_t count, unsigned long long cas);
 int memcached_delete(char *key);
+int memcached_delete_multi(char **keys, int num_keys);
+int memcached_incr(char *key, unsigned long long delta, unsigned long long *value);
 
 int memcached_flush_all();
@@ -0,0 +1,208 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#include "uthash.h"
+#include "negative_cache.h"
+
+typedef struct missing_path
+{
+    char *path;
+    struct timespec stored; /* path is known missing for timeout seconds after it */
+    UT_hash_handle hh;
+} missing_path;
+
+/* uthash keeps insertion order, so first entry is oldest one */
+static missing_path *paths = NULL;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double timeout = 0;
+
+/* bumped by every invalidation, path that was looked up before it may exist now */
+static unsigned long generation = 0;
+
+static unsigned long hits = 0;
+static unsigned long misses = 0;
+
+static void remove_path(missing_path *entry)
+{
+    HASH_DEL(paths, entry);
+
+    free(entry->path);
+    free(entry);
+}
+
+static int expired(missing_path *entry)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    double age = (now.tv_sec - entry->stored.tv_sec) + (now.tv_nsec - entry->stored.tv_nsec) / 1e9;
+
+    return age >= timeout;
+}
+
+/* paths are remembered as missing for timeout seconds, 0 disables cache */
+
+void negative_cache_init(double cache_timeout)
+{
+    timeout = cache_timeout;
+}
+
+/* returns 1 if path was looked up recently and did not exist, 0 otherwise */
+
+int negative_cache_contains(const char *path)
+{
+    if (timeout <= 0)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&lock);
+
+    missing_path *entry = NULL;
+    HASH_FIND_STR(paths, path, entry);
+
+    if (entry != NULL && expired(entry))
+    {
+        remove_path(entry);
+        entry = NULL;
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    if (entry == NULL)
+    {
+        __atomic_add_fetch(&misses, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    __atomic_add_fetch(&hits, 1, __ATOMIC_RELAXED);
+
+    return 1;
+}
+
+/* generation to read before looking path up and to pass to negative_cache_add */
+
+unsigned long negative_cache_generation()
+{
+    pthread_mutex_lock(&lock);
+    unsigned long current = generation;
+    pthread_mutex_unlock(&lock);
+
+    return current;
+}
+
+/* remembers path as missing, unless some path was invalidated since lookup_generation (it may have been
+   created while it was looked up). oldest path is dropped when cache is full */
+
+void negative_cache_add(const char *path, unsigned long lookup_generation)
+{
+    if (timeout <= 0)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&lock);
+
+    if (lookup_generation != generation)
+    {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+
+    missing_path *entry = NULL;
+    HASH_FIND_STR(paths, path, entry);
+
+    if (entry != NULL)
+    {
+        remove_path(entry);
+    }
+    else if (HASH_COUNT(paths) >= NEGATIVE_CACHE_MAX_ENTRIES)
+    {
+        remove_path(paths);
+    }
+
+    entry = (missing_path *)malloc(sizeof(missing_path));
+    entry->path = strdup(path);
+    clock_gettime(CLOCK_MONOTONIC, &entry->stored);
+
+    HASH_ADD_KEYPTR(hh, paths, entry->path, strlen(entry->path), entry);
+
+    pthread_mutex_unlock(&lock);
+}
+
+/* called after path is made to exist: lookups that started before it get new generation and do not cache
+   path as missing */
+
+void negative_cache_invalidate(const char *path)
+{
+    if (timeout <= 0)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&lock);
+
+    generation++;
+
+    missing_path *entry = NULL;
+    HASH_FIND_STR(paths, path, entry);
+
+    if (entry != NULL)
+    {
+        remove_path(entry);
+    }
+
+    pthread_mutex_unlock(&lock);
+}
+
+/* drops path and every path under it (path/...), for renamed directories */
+
+void negative_cache_invalidate_prefix(const char *path)
+{
+    if (timeout <= 0)
+    {
+        return;
+    }
+
+    size_t path_size = strlen(path);
+
+    pthread_mutex_lock(&lock);
+
+    generation++;
+
+    missing_path *entry, *tmp;
+
+    HASH_ITER(hh, paths, entry, tmp)
+    {
+        if (strncmp(entry->path, path, path_size) == 0 && (entry->path[path_size] == '\0' || entry->path[path_size] == '/'))
+        {
+            remove_path(entry);
+        }
+    }
+
+    pthread_mutex_unlock(&lock);
+}
+
+void negative_cache_stats(unsigned long *cache_hits, unsigned long *cache_misses)
+{
+    *cache_hits = __atomic_load_n(&hits, __ATOMIC_RELAXED);
+    *cache_misses = __atomic_load_n(&misses, __ATOMIC_RELAXED);
+}
+
+void negative_cache_free()
+{
+    pthread_mutex_lock(&lock);
+
+    missing_path *entry, *tmp;
+
+    HASH_ITER(hh, paths, entry, tmp)
+    {
+        remove_path(entry);
+    }
+
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,10 @@
+#define NEGATIVE_CACHE_MAX_ENTRIES 16384
+
+void negative_cache_init(double timeout);
+int negative_cache_contains(const char *path);
+unsigned long negative_cache_generation();
+void negative_cache_add(const char *path, unsigned long lookup_generation);
+void negative_cache_invalidate(const char *path);
+void negative_cache_invalidate_prefix(const char *path);
+void negative_cache_stats(unsigned long *hits, unsigned long *misses);
+void negative_cache_free();
@@ -22,7 +22,7 @@ file_blocks_t *get_file_blocks_info(off_t offset, size_t size, int block_size)
     {
         int s = size - bytes_left_in_start_block;
 
-        if (size % block_size == 0)
+        if (s % block_size == 0)
         {
             block->num_blocks = 1 + (int)(s / block_size);
             block->bytes_in_end_block = block_size;